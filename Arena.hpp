@@ -0,0 +1,107 @@
+#ifndef Arena_hpp
+#define Arena_hpp
+
+#include <stdio.h>
+#include <string.h>
+#include <sys/types.h>
+#include <sys/mman.h>
+#include <algorithm>
+#include <vector>
+
+#define ARENA_SLAB_SIZE (2 << 20) // slab of arena (= huge page)
+
+namespace BPT {
+
+// memory of the in-memory tree: offsets of blocks are resolved to slabs
+// MARK: slabs are mmap-ed, so they are aligned by the page (and by the cache line too)
+class Arena {
+private:
+    std::vector<char *> slabs;
+    bool huge;
+    
+    char *newSlab () {
+        void *slab = MAP_FAILED;
+#ifdef MAP_HUGETLB
+        if (huge) slab = mmap(nullptr, ARENA_SLAB_SIZE, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB, -1, 0);
+#endif
+        /* no reserved huge pages --> usual pages (transparent huge pages if they are allowed) */
+        if (slab == MAP_FAILED) {
+            slab = mmap(nullptr, ARENA_SLAB_SIZE, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+            if (slab == MAP_FAILED) return nullptr;
+#ifdef MADV_HUGEPAGE
+            if (huge) madvise(slab, ARENA_SLAB_SIZE, MADV_HUGEPAGE);
+#endif
+        }
+        return (char *)slab;
+    }
+
+public:
+    explicit Arena (bool hugePages = false) : huge(hugePages) {}
+    
+    ~Arena () {
+        for (char *slab : slabs) munmap(slab, ARENA_SLAB_SIZE);
+    }
+    
+    Arena (const Arena &) = delete;
+    Arena &operator = (const Arena &) = delete;
+    
+    size_t size () const {return slabs.size() * ARENA_SLAB_SIZE;}
+    
+    /* place of block (nullptr if it isn't allocated yet) */
+    char *at (off_t offset) const {
+        size_t slab = size_t(offset) / ARENA_SLAB_SIZE;
+        return slab < slabs.size() ? slabs[slab] + offset % ARENA_SLAB_SIZE : nullptr;
+    }
+    
+    /* place for "size" bytes from "slot" which doesn't cross the slab (if it can) */
+    static off_t fit (off_t slot, size_t size) {
+        size_t inSlab = size_t(slot) % ARENA_SLAB_SIZE;
+        if (size <= ARENA_SLAB_SIZE && inSlab + size > ARENA_SLAB_SIZE) slot += ARENA_SLAB_SIZE - inSlab;
+        return slot;
+    }
+    
+    /* copying [offset:offset + size) out in "block" */
+    int read (void *block, off_t offset, size_t size) const {
+        char *to = (char *)block;
+        while (size > 0) {
+            const char *from = at(offset);
+            if (from == nullptr) return -1;
+            
+            size_t part = std::min(size, ARENA_SLAB_SIZE - size_t(offset) % ARENA_SLAB_SIZE);
+            memcpy(to, from, part);
+            to += part; offset += part; size -= part;
+        }
+        return 0;
+    }
+    
+    /* copying "block" in [offset:offset + size), new slabs are added */
+    int write (const void *block, off_t offset, size_t size) {
+        const char *from = (const char *)block;
+        while (size > 0) {
+            while (at(offset) == nullptr) {
+                char *slab = newSlab();
+                if (slab == nullptr) return -1;
+                slabs.push_back(slab);
+            }
+            
+            size_t part = std::min(size, ARENA_SLAB_SIZE - size_t(offset) % ARENA_SLAB_SIZE);
+            memcpy(at(offset), from, part);
+            from += part; offset += part; size -= part;
+        }
+        return 0;
+    }
+    
+    /* writing [0:size) out in the file (one sequential write of slabs) */
+    int dump (FILE *F, size_t size) const {
+        for (size_t i = 0; i < slabs.size() && size > 0; ++i) {
+            size_t part = std::min(size, size_t(ARENA_SLAB_SIZE));
+            if (fwrite(slabs[i], part, 1, F) != 1) return -1;
+            size -= part;
+        }
+        return size == 0 ? 0 : -1;
+    }
+};
+
+}
+
+#endif /* Arena_hpp */
@@ -1,4 +1,9 @@
 #include "BPlusTree.hpp"
+#include "ThreadPool.hpp"
+#include "Compression.hpp"
+#include "Tablespace.hpp"
+#include <map>
+#include <fcntl.h>
 
 
 // IMPLEMENTATION OF B-PLUS-TREE
@@ -15,18 +20,29 @@ void  BPlusTree::openFile (const char *mode) const {
     /* so "rb+" (default mode in this case) help us to write data with no truncating */
     /* but you can always change "mode" for your purposes */
     
-    if (fileLevel == 0) F = fopen(filePath, mode);
+    /* file of tablespace is always opened */
+    if (fileLevel == 0 && !arena) F = space ? space->file() : fopen(filePath, mode);
     
     ++fileLevel;
 }
 /* closing file */
 void  BPlusTree::closeFile () const {
-    if (fileLevel == 1) fclose(F);
+    if (fileLevel == 1 && !arena) {
+        if (space) fflush(F);
+        else fclose(F);
+        if (pages) pages->flushed();
+    }
     
     --fileLevel;
 }
 /* allocation the place in the file */
 offT  BPlusTree::alloc (sizeT size) {
+    /* blocks of all trees of tablespace are taken from one place */
+    if (space) return space->alloc(size);
+    
+    /* in memory the block doesn't cross the slab, so the page can be read in place */
+    if (arena) meta.slot = Arena::fit(meta.slot, size);
+    
     offT slot = meta.slot;
     meta.slot += size; /* shift the slot for the future alocations */
     return slot;
@@ -35,8 +51,9 @@ offT  BPlusTree::alloc (sizeT size) {
 /* it uses alloc(sizeT size) */
 offT  BPlusTree::alloc (leafT *leaf) {
     leaf->countChilds = 0;
+    leaf->heap = 0;
     ++meta.countLeaf;
-    return alloc(sizeof(leafT));
+    return alloc(LEAF_PAGE_SIZE);
 }
 /* allocation the place for node */
 /* it uses alloc(sizeT size) */
@@ -55,10 +72,34 @@ void  BPlusTree::unalloc (nodeT *node, offT offset) {
 }
 /* reading the file and writing read one out in the "block" */
 int  BPlusTree::map (void *block, offT offset, sizeT size) const {
+    if (pages && pages->read(block, offset, size)) return 0;
+    
+    return mapFile(block, offset, size, false);
+}
+/* reading the node (it's kept in the cache, leaf pages are kept by mapPage) */
+int  BPlusTree::map (nodeT *node, offT offset) const {
+    if (pages && pages->read(node, offset, sizeof(nodeT))) return 0;
+    
+    int R = mapFile(node, offset, sizeof(nodeT), false);
+    if (pages && R == 0) pages->insert(offset, node, sizeof(nodeT));
+    return R;
+}
+/* reading the file (or the arena) past the cache */
+/* "parallel" --> positional read, MARK: the file must be already opened (openFile) by the caller, workers never touch "fileLevel" */
+int  BPlusTree::mapFile (void *block, offT offset, sizeT size, bool parallel) const {
+    metrics.add(Metrics::PAGE_READS);
+    metrics.add(Metrics::BYTES_READ, size);
+    if (arena) return arena->read(block, offset, size);
+    
+    if (parallel) {
+        return pread(fileno(F), block, size, offset) == ssize_t(size) ? 0 : -1;
+    }
+    
     openFile();
     fseek(F, offset, SEEK_SET);
     sizeT R = fread(block, size, 1, F);
     closeFile();
+    
     return int(R) - 1;
 }
 /* map function for lazy >3 */
@@ -68,6 +109,11 @@ int  BPlusTree::map (T *block, offT offset) const {
 }
 /* writing the "block" out in the file  */
 int  BPlusTree::unmap (void *block, offT offset, sizeT size) const {
+    metrics.add(Metrics::PAGE_WRITES);
+    metrics.add(Metrics::BYTES_WRITTEN, size);
+    if (arena) return arena->write(block, offset, size);
+    if (pages) pages->write(block, offset, size);
+    
     openFile();
     fseek(F, offset, SEEK_SET);
     sizeT W = fwrite(block, size, 1, F);
@@ -81,6 +127,27 @@ template <class T>
 int  BPlusTree:: unmap (T *block, offT offset) const {
     return unmap(block, offset, sizeof(T));
 }
+/* writing only the dirty part of the block: header + children[from:to) */
+template <class T>
+int  BPlusTree::unmapChilds (T *block, offT offset, typename T::childT from, typename T::childT to) const {
+    openFile();
+    int W = unmap(block, offset, SIZEWITHNOCHILD);
+    
+    if (from < to) {
+        sizeT shift = (char *)from - (char *)block;
+        W |= unmap(from, offset + shift, (char *)to - (char *)from);
+    }
+    closeFile();
+    
+    return W;
+}
+/* reading without the shared position of "F" */
+/* MARK: the file must be already opened (openFile) by the caller */
+int  BPlusTree::pmap (void *block, offT offset, sizeT size) const {
+    if (pages && pages->read(block, offset, size)) return 0;
+    
+    return mapFile(block, offset, size, true);
+}
 
 /* ---------------------- */
 
@@ -113,6 +180,489 @@ inline recordT *find (leafT &leaf, const keyT &key) {
     return std::lower_bound(begin(leaf), end(leaf), key);
 }
 
+/* PART: SLOTTED PAGES (LEAFS) */
+/* page: header | heap | slots (offsets of cells in the order of keys) | free place | cells */
+/* cell: length of key (1) | key | length of value (2) | value or (size (4) | first overflow page) */
+/* overflow page: next page | used | part of value */
+/* compressed page: header (heap = PACKED_MARK | size of data) | heap of plain page | data (slots + cells by LZ) */
+static const sizeT LEAF_HEADER = SIZEWITHNOCHILD + sizeof(uint32_t);
+static const sizeT LEAF_CAPACITY = LEAF_PAGE_SIZE - LEAF_HEADER;
+static const sizeT MAX_CHARGE = LEAF_CAPACITY / 4; // biggest record (bigger value goes to overflow pages)
+static const sizeT MIN_CHARGE = (LEAF_CAPACITY + LEAF_ORDER - 1) / LEAF_ORDER; // smallest record (so count of records <= LEAF_ORDER)
+static const sizeT LEAF_MIN = (LEAF_CAPACITY - MAX_CHARGE) / 2; // less --> leaf borrows or merges
+static const uint16_t OVERFLOW_MARK = 0xFFFF;
+static const sizeT OVERFLOW_HEADER = sizeof(offT) + sizeof(uint32_t);
+static const uint32_t PACKED_MARK = 0x80000000;
+static const sizeT PACKED_HEADER = LEAF_HEADER + sizeof(uint32_t);
+
+static_assert(LEAF_PAGE_SIZE <= 0xFFFF, "cells' offsets are 2 bytes");
+static_assert(KEY_SIZE <= 0x100, "length of key is 1 byte");
+
+/* SUBPART: values */
+/* length of field: 1 byte (< 0xFF) or 0xFF + 4 bytes */
+inline sizeT fieldBytes (const std::string &field) {
+    return (field.size() < 0xFF ? 1 : 1 + sizeof(uint32_t)) + field.size();
+}
+inline char *packField (const std::string &field, char *to) {
+    if (field.size() < 0xFF) *to++ = char(field.size());
+    else {
+        uint32_t size = uint32_t(field.size());
+        *to++ = char(0xFF);
+        memcpy(to, &size, sizeof(size)); to += sizeof(size);
+    }
+    memcpy(to, field.data(), field.size());
+    return to + field.size();
+}
+inline const char *unpackField (std::string &field, const char *from, const char *last) {
+    if (from == nullptr || from >= last) return nullptr;
+    
+    uint32_t size = (unsigned char)*from++;
+    if (size == 0xFF) {
+        if (last - from < ssize_t(sizeof(size))) return nullptr;
+        memcpy(&size, from, sizeof(size)); from += sizeof(size);
+    }
+    if (last - from < ssize_t(size)) return nullptr;
+    
+    field.assign(from, size);
+    return from + size;
+}
+
+/* Entry: birth, homeBlock, homeRoom, fac (MARK: "name" is a pointer, it isn't saved) */
+inline sizeT valueBytes (const valueT &value) {
+    return fieldBytes(value.birth) + fieldBytes(value.homeBlock) + fieldBytes(value.homeRoom) + fieldBytes(value.fac);
+}
+inline void packValue (const valueT &value, char *to) {
+    to = packField(value.birth, to);
+    to = packField(value.homeBlock, to);
+    to = packField(value.homeRoom, to);
+    packField(value.fac, to);
+}
+inline bool unpackValue (valueT &value, const char *from, sizeT size) {
+    const char *last = from + size;
+    from = unpackField(value.birth, from, last);
+    from = unpackField(value.homeBlock, from, last);
+    from = unpackField(value.homeRoom, from, last);
+    from = unpackField(value.fac, from, last);
+    return from == last;
+}
+
+/* SUBPART: records */
+/* value is kept in the cell (else in overflow pages) */
+inline bool inlined (const recordT &record, sizeT value) {
+    return sizeof(uint16_t) + 1 + strlen(record.key.K) + sizeof(uint16_t) + value <= MAX_CHARGE;
+}
+/* size of cell of record */
+inline sizeT cellBytes (const recordT &record) {
+    sizeT value = valueBytes(record.value);
+    sizeT head = 1 + strlen(record.key.K) + sizeof(uint16_t);
+    
+    return head + (inlined(record, value) ? value : sizeof(uint32_t) + sizeof(offT));
+}
+/* place of record on the page (cell + slot) */
+inline sizeT charge (const recordT &record) {
+    return std::max(cellBytes(record) + sizeof(uint16_t), MIN_CHARGE);
+}
+/* used place of the page */
+inline sizeT fill (leafT &leaf) {
+    sizeT used = 0;
+    for (recordT *r = begin(leaf); r != end(leaf); ++r) used += charge(*r);
+    return used;
+}
+/* split point of overfull leaf (halves are even by bytes) */
+inline sizeT splitPoint (leafT &leaf) {
+    sizeT total = fill(leaf), left = 0, point = 0;
+    while (point < leaf.countChilds && 2 * (left + charge(leaf.child[point])) <= total)
+        left += charge(leaf.child[point++]);
+    
+    /* the next record goes to the left if it's more even */
+    if (point < leaf.countChilds && 2 * (left + charge(leaf.child[point])) - total < total - 2 * left)
+        ++point;
+    
+    return std::min(std::max(point, sizeT(1)), leaf.countChilds - 1);
+}
+/* writing cell of record out in "to" (overflow pages are already written) */
+inline void packCell (const recordT &record, char *to) {
+    sizeT key = strlen(record.key.K), value = valueBytes(record.value);
+    
+    *to++ = char(key);
+    memcpy(to, record.key.K, key); to += key;
+    
+    if (inlined(record, value)) {
+        uint16_t size = uint16_t(value);
+        memcpy(to, &size, sizeof(size)); to += sizeof(size);
+        packValue(record.value, to);
+    } else {
+        uint16_t mark = OVERFLOW_MARK;
+        uint32_t size = uint32_t(value);
+        memcpy(to, &mark, sizeof(mark)); to += sizeof(mark);
+        memcpy(to, &size, sizeof(size)); to += sizeof(size);
+        memcpy(to, &record.overflow, sizeof(offT));
+    }
+}
+/* SUBPART: lookups on the page (cells aren't unpacked) */
+inline sizeT pageCount (const char *page) {
+    sizeT count;
+    memcpy(&count, page + 3 * sizeof(offT), sizeof(sizeT));
+    return count;
+}
+inline uint16_t pageSlot (const char *page, sizeT i) {
+    uint16_t cell;
+    memcpy(&cell, page + LEAF_HEADER + i * sizeof(uint16_t), sizeof(cell));
+    return cell;
+}
+/* key of the cell vs "key" (as keycmp) */
+inline int cellcmp (const char *cell, const keyT &key) {
+    sizeT length = (unsigned char)*cell, other = strlen(key.K);
+    if (length != other) return int(length) - int(other);
+    return memcmp(cell + 1, key.K, length);
+}
+/* index of the first record >= "key" of "count" records (binary search by the slots) */
+inline sizeT lowerBound (const char *page, sizeT count, const keyT &key) {
+    sizeT low = 0, high = count;
+    while (low < high) {
+        sizeT mid = (low + high) / 2;
+        if (cellcmp(page + pageSlot(page, mid), key) < 0) low = mid + 1;
+        else high = mid;
+    }
+    return low;
+}
+
+/* header of page */
+inline void packHeader (const leafT &leaf, char *to) {
+    memcpy(to, &leaf.parent, sizeof(offT)); to += sizeof(offT);
+    memcpy(to, &leaf.next, sizeof(offT)); to += sizeof(offT);
+    memcpy(to, &leaf.prev, sizeof(offT)); to += sizeof(offT);
+    memcpy(to, &leaf.countChilds, sizeof(sizeT)); to += sizeof(sizeT);
+    memcpy(to, &leaf.heap, sizeof(uint32_t));
+}
+
+/* SUBPART: compression of pages */
+/* plain page --> "to" (size of data, 0 --> compression doesn't save bytes) */
+inline sizeT packPage (const char *page, uint32_t heap, sizeT count, char *to) {
+    char plain[LEAF_PAGE_SIZE];
+    sizeT slots = count * sizeof(uint16_t), cells = LEAF_PAGE_SIZE - heap;
+    memcpy(plain, page + LEAF_HEADER, slots);
+    memcpy(plain + slots, page + heap, cells);
+    
+    /* plain page is written as header + slots + cells */
+    if (slots + cells <= sizeof(uint32_t) + 1) return 0;
+    sizeT packed = lzCompress(plain, slots + cells, to + PACKED_HEADER, slots + cells - sizeof(uint32_t) - 1);
+    if (packed == 0) return 0;
+    
+    uint32_t mark = PACKED_MARK | uint32_t(packed);
+    memcpy(to, page, LEAF_HEADER);
+    memcpy(to + SIZEWITHNOCHILD, &mark, sizeof(mark));
+    memcpy(to + LEAF_HEADER, &heap, sizeof(heap));
+    return packed;
+}
+/* header + heap of plain page are in "page", data of "packed" bytes --> plain page */
+inline int unpackPage (char *page, const char *data, sizeT packed) {
+    sizeT count;
+    uint32_t heap;
+    memcpy(&count, page + 3 * sizeof(offT), sizeof(sizeT));
+    memcpy(&heap, page + LEAF_HEADER, sizeof(heap));
+    
+    sizeT slots = count * sizeof(uint16_t);
+    if (count > LEAF_ORDER || heap > LEAF_PAGE_SIZE || heap < LEAF_HEADER + slots) return -1;
+    
+    char plain[LEAF_PAGE_SIZE];
+    sizeT cells = LEAF_PAGE_SIZE - heap;
+    if (lzDecompress(data, packed, plain, slots + cells) != ssize_t(slots + cells)) return -1;
+    
+    memcpy(page + SIZEWITHNOCHILD, &heap, sizeof(heap));
+    memcpy(page + LEAF_HEADER, plain, slots);
+    memcpy(page + heap, plain + slots, cells);
+    return 0;
+}
+
+/* SUBPART: reading/writing of pages */
+/* page --> leaf */
+int  BPlusTree::unpackLeaf (leafT *leaf, const char *page, bool parallel) const {
+    const char *from = page;
+    memcpy(&leaf->parent, from, sizeof(offT)); from += sizeof(offT);
+    memcpy(&leaf->next, from, sizeof(offT)); from += sizeof(offT);
+    memcpy(&leaf->prev, from, sizeof(offT)); from += sizeof(offT);
+    memcpy(&leaf->countChilds, from, sizeof(sizeT)); from += sizeof(sizeT);
+    memcpy(&leaf->heap, from, sizeof(uint32_t));
+    
+    if (leaf->countChilds > LEAF_ORDER) return -1;
+    
+    for (sizeT i = 0; i < leaf->countChilds; ++i)
+        if (unpackRecord(leaf->child[i], page, pageSlot(page, i), parallel) != 0) return -1;
+    
+    return 0;
+}
+/* cell --> record */
+int  BPlusTree::unpackRecord (recordT &record, const char *page, uint16_t cell, bool parallel) const {
+    if (cell < LEAF_HEADER || cell >= LEAF_PAGE_SIZE) return -1;
+    
+    const char *c = page + cell;
+    sizeT key = (unsigned char)*c++;
+    if (key >= KEY_SIZE) return -1;
+    memcpy(record.key.K, c, key); c += key;
+    bzero(record.key.K + key, KEY_SIZE - key);
+    
+    uint16_t value;
+    memcpy(&value, c, sizeof(value)); c += sizeof(value);
+    
+    if (value != OVERFLOW_MARK) {
+        record.overflow = 0;
+        if (!unpackValue(record.value, c, value)) return -1;
+        record.room = uint16_t(1 + key + sizeof(uint16_t) + value);
+    } else {
+        uint32_t size;
+        memcpy(&size, c, sizeof(size)); c += sizeof(size);
+        memcpy(&record.overflow, c, sizeof(offT));
+        
+        std::string data;
+        if (mapOverflow(data, record.overflow, size, parallel) != 0) return -1;
+        if (!unpackValue(record.value, data.data(), data.size())) return -1;
+        record.room = uint16_t(1 + key + sizeof(uint16_t) + sizeof(uint32_t) + sizeof(offT));
+    }
+    
+    record.cell = cell;
+    record.dirty = false;
+    return 0;
+}
+/* reading the leaf */
+int  BPlusTree::map (leafT *leaf, offT offset) const {
+    /* in memory the page is unpacked in place */
+    if (arena) {
+        metrics.add(Metrics::PAGE_READS);
+        metrics.add(Metrics::BYTES_READ, LEAF_PAGE_SIZE);
+        return arena->at(offset) ? unpackLeaf(leaf, arena->at(offset), false) : -1;
+    }
+    
+    char page[LEAF_PAGE_SIZE];
+    
+    openFile();
+    int R = mapPage(page, offset, false);
+    if (R == 0) R = unpackLeaf(leaf, page, false);
+    closeFile();
+    
+    return R;
+}
+/* reading the leaf (by several threads) */
+int  BPlusTree::pmap (leafT *leaf, offT offset) const {
+    if (arena) {
+        metrics.add(Metrics::PAGE_READS);
+        metrics.add(Metrics::BYTES_READ, LEAF_PAGE_SIZE);
+        return arena->at(offset) ? unpackLeaf(leaf, arena->at(offset), true) : -1;
+    }
+    
+    char page[LEAF_PAGE_SIZE];
+    
+    int R = mapPage(page, offset, true);
+    if (R == 0) R = unpackLeaf(leaf, page, true);
+    
+    return R;
+}
+/* reading the plain page (compressed page is read by its size only and decoded) */
+/* MARK: the cache keeps plain pages */
+int  BPlusTree::mapPage (char *page, offT offset, bool parallel) const {
+    if (pages && pages->read(page, offset, LEAF_PAGE_SIZE)) return 0;
+    
+    /* no compressed pages in the file --> one read */
+    if (!(meta.flags & META_PACKED)) {
+        if (mapFile(page, offset, LEAF_PAGE_SIZE, parallel) != 0) return -1;
+    } else {
+        if (mapFile(page, offset, PACKED_HEADER, parallel) != 0) return -1;
+        
+        uint32_t heap;
+        memcpy(&heap, page + SIZEWITHNOCHILD, sizeof(heap));
+        
+        if (heap & PACKED_MARK) {
+            char data[LEAF_PAGE_SIZE];
+            sizeT packed = heap & ~PACKED_MARK;
+            
+            if (packed > LEAF_PAGE_SIZE - PACKED_HEADER) return -1;
+            if (mapFile(data, offset + PACKED_HEADER, packed, parallel) != 0) return -1;
+            if (unpackPage(page, data, packed) != 0) return -1;
+        }
+        else if (mapFile(page + PACKED_HEADER, offset + PACKED_HEADER, LEAF_PAGE_SIZE - PACKED_HEADER, parallel) != 0) return -1;
+    }
+    
+    if (pages) pages->insert(offset, page, LEAF_PAGE_SIZE);
+    return 0;
+}
+/* plain page for reading (the arena keeps plain pages, so it isn't copied) */
+const char  *BPlusTree::pageAt (offT offset, char *buffer) const {
+    if (arena) {
+        metrics.add(Metrics::PAGE_READS);
+        metrics.add(Metrics::BYTES_READ, LEAF_PAGE_SIZE);
+        return arena->at(offset);
+    }
+    
+    openFile();
+    int R = mapPage(buffer, offset, false);
+    closeFile();
+    
+    return R == 0 ? buffer : nullptr;
+}
+/* node for reading (MARK: the node in the arena is valid till the next change of the tree) */
+const nodeT  *BPlusTree::nodeAt (offT offset, void *buffer) const {
+    if (arena) {
+        metrics.add(Metrics::PAGE_READS);
+        metrics.add(Metrics::BYTES_READ, sizeof(nodeT));
+        return (const nodeT *)arena->at(offset);
+    }
+    
+    nodeT *node = (nodeT *)buffer;
+    return map(node, offset) == 0 ? node : nullptr;
+}
+/* big value of dirty record --> new overflow pages */
+/* MARK: old overflow pages aren't reused (as other blocks, see unalloc) */
+void  BPlusTree::unmapValue (recordT &record) {
+    if (!record.dirty) return;
+    
+    sizeT value = valueBytes(record.value);
+    record.overflow = 0;
+    
+    if (!inlined(record, value)) {
+        std::string data(value, '\0');
+        packValue(record.value, &data[0]);
+        record.overflow = unmapOverflow(data.data(), value);
+    }
+}
+/* writing the whole leaf (cells are packed again from the end of page) */
+int  BPlusTree::unmap (leafT *leaf, offT offset) {
+    assert(fill(*leaf) <= LEAF_CAPACITY);
+    
+    char page[LEAF_PAGE_SIZE];
+    uint32_t heap = LEAF_PAGE_SIZE;
+    
+    openFile();
+    for (sizeT i = 0; i < leaf->countChilds; ++i) {
+        recordT &record = leaf->child[i];
+        unmapValue(record);
+        
+        sizeT bytes = cellBytes(record);
+        heap -= bytes;
+        packCell(record, page + heap);
+        
+        record.cell = uint16_t(heap);
+        record.room = uint16_t(bytes);
+        record.dirty = false;
+        memcpy(page + LEAF_HEADER + i * sizeof(uint16_t), &record.cell, sizeof(uint16_t));
+    }
+    assert(heap >= LEAF_HEADER + leaf->countChilds * sizeof(uint16_t));
+    
+    leaf->heap = heap;
+    packHeader(*leaf, page);
+    
+    /* free place in the middle isn't written (empty page is written in full, so the page is in the file) */
+    int W;
+    char packed[LEAF_PAGE_SIZE];
+    sizeT size;
+    
+    if (heap == LEAF_PAGE_SIZE) {
+        bzero(page + LEAF_HEADER, LEAF_CAPACITY);
+        W = unmap(page, offset, LEAF_PAGE_SIZE);
+    } else if ((meta.flags & META_COMPRESS) && (size = packPage(page, heap, leaf->countChilds, packed)) != 0) {
+        W = unmap(packed, offset, PACKED_HEADER + size);
+        
+        /* the cache keeps the plain page */
+        if (pages) pages->insert(offset, page, LEAF_PAGE_SIZE);
+    } else {
+        W = unmap(page, offset, LEAF_HEADER + leaf->countChilds * sizeof(uint16_t));
+        W |= unmap(page + heap, offset + heap, LEAF_PAGE_SIZE - heap);
+    }
+    closeFile();
+    
+    return W;
+}
+/* writing header, slots[from:to) and new cells of dirty records */
+int  BPlusTree::unmapChilds (leafT *leaf, offT offset, recordT *from, recordT *to) {
+    /* page wasn't read or it can be compressed --> it's written in full */
+    if (leaf->heap == 0 || (meta.flags & META_PACKED)) return unmap(leaf, offset);
+    
+    /* no place for new cells --> page is packed again */
+    sizeT heap = leaf->heap;
+    for (recordT *r = from; r < to; ++r) {
+        if (!r->dirty) continue;
+        
+        sizeT bytes = cellBytes(*r);
+        if (r->cell == 0 || bytes > r->room) heap = heap > bytes ? heap - bytes : 0;
+    }
+    if (heap < LEAF_HEADER + leaf->countChilds * sizeof(uint16_t)) return unmap(leaf, offset);
+    
+    char cell[LEAF_PAGE_SIZE];
+    uint16_t slots[LEAF_ORDER + 1];
+    int W = 0;
+    
+    openFile();
+    for (recordT *r = from; r < to; ++r) {
+        if (!r->dirty) continue;
+        unmapValue(*r);
+        
+        /* smaller cell is rewritten in place */
+        sizeT bytes = cellBytes(*r);
+        if (r->cell == 0 || bytes > r->room) {
+            leaf->heap -= bytes;
+            r->cell = uint16_t(leaf->heap);
+            r->room = uint16_t(bytes);
+        }
+        
+        packCell(*r, cell);
+        W |= unmap(cell, offset + r->cell, bytes);
+        r->dirty = false;
+    }
+    
+    char header[LEAF_HEADER];
+    packHeader(*leaf, header);
+    W |= unmap(header, offset, LEAF_HEADER);
+    
+    if (from < to) {
+        for (recordT *r = from; r < to; ++r) slots[r - from] = r->cell;
+        W |= unmap(slots, offset + LEAF_HEADER + (from - begin(*leaf)) * sizeof(uint16_t), (to - from) * sizeof(uint16_t));
+    }
+    closeFile();
+    
+    return W;
+}
+/* writing value out in new overflow pages (one after another) */
+offT  BPlusTree::unmapOverflow (const char *data, sizeT size) {
+    const sizeT part = LEAF_PAGE_SIZE - OVERFLOW_HEADER;
+    sizeT pages = (size + part - 1) / part;
+    
+    offT first = alloc(pages * LEAF_PAGE_SIZE);
+    meta.countOverflow += pages;
+    
+    char page[LEAF_PAGE_SIZE];
+    openFile();
+    for (sizeT k = 0; k < pages; ++k) {
+        offT next = k + 1 < pages ? first + offT((k + 1) * LEAF_PAGE_SIZE) : 0;
+        uint32_t used = uint32_t(std::min(part, size - k * part));
+        
+        memcpy(page, &next, sizeof(offT));
+        memcpy(page + sizeof(offT), &used, sizeof(uint32_t));
+        memcpy(page + OVERFLOW_HEADER, data + k * part, used);
+        unmap(page, first + offT(k * LEAF_PAGE_SIZE), OVERFLOW_HEADER + used);
+    }
+    unmap(&meta, metaOffset);
+    closeFile();
+    
+    return first;
+}
+/* reading value of "size" bytes from the overflow pages */
+int  BPlusTree::mapOverflow (std::string &data, offT offset, sizeT size, bool parallel) const {
+    char page[LEAF_PAGE_SIZE];
+    
+    data.clear();
+    data.reserve(size);
+    while (data.size() < size && offset != 0) {
+        sizeT want = std::min<sizeT>(LEAF_PAGE_SIZE, OVERFLOW_HEADER + size - data.size());
+        if ((parallel ? pmap(page, offset, want) : map(page, offset, want)) != 0) return -1;
+        
+        uint32_t used;
+        memcpy(&offset, page, sizeof(offT));
+        memcpy(&used, page + sizeof(offT), sizeof(uint32_t));
+        data.append(page + OVERFLOW_HEADER, std::min<sizeT>(used, size - data.size()));
+    }
+    
+    return data.size() == size ? 0 : -1;
+}
+
 /* PART: BPLUS-TREE FUNCTIONS */
 /* Initialization from empty file*/
 void  BPlusTree::initEmpty () {
@@ -134,25 +684,271 @@ void  BPlusTree::initEmpty () {
     meta.leafOffset = root.child[0].child = alloc(&leaf);
     
     // saving in the file
-    unmap(&meta, OFFSET_META);
+    unmap(&meta, metaOffset);
     unmap(&root, meta.rootOffset);
     unmap(&leaf, root.child[0].child);
 }
 
 
 /* Constructor */
-BPlusTree::BPlusTree (const char *newPath, bool forceEmpty) : F(nullptr), fileLevel(0) {
+BPlusTree::BPlusTree (const char *newPath, bool forceEmpty, bool useFilter)
+    : filterRate(0.01), F(nullptr), fileLevel(0), space(nullptr), metaOffset(OFFSET_META), stopPrefetch(false) {
     bzero(filePath, sizeof(filePath));
     strcpy(filePath, newPath);
     
     /* reading tree */
-    if (!forceEmpty) { if (map(&meta, OFFSET_META) != 0) forceEmpty = true; }
+    if (!forceEmpty) { if (map(&meta, metaOffset) != 0) forceEmpty = true; }
     else {
         // to truncate file
         openFile("w+");
         initEmpty();
         closeFile();
     }
+    
+    if (useFilter) enableFilter();
+}
+/* In-memory tree */
+BPlusTree::BPlusTree (bool hugePages)
+    : filterRate(0.01), F(nullptr), fileLevel(0), arena(new Arena(hugePages)), space(nullptr), metaOffset(OFFSET_META), stopPrefetch(false) {
+    bzero(filePath, sizeof(filePath));
+    initEmpty();
+}
+
+/* Tree of tablespace ("metaOffset" is given by the tablespace) */
+BPlusTree::BPlusTree (Tablespace *newSpace, offT newMeta, bool create)
+    : filterRate(0.01), F(nullptr), fileLevel(0), space(newSpace), metaOffset(newMeta), stopPrefetch(false) {
+    bzero(filePath, sizeof(filePath));
+    strcpy(filePath, space->path());
+    pages = space->pool();
+    
+    if (create || map(&meta, metaOffset) != 0) initEmpty();
+}
+
+BPlusTree::~BPlusTree () {
+    stopWarmUp();
+    if (pages && !space) saveHotPages();
+}
+
+/* Writing the arena out in the file (blocks keep their offsets) */
+int  BPlusTree::persist (const char *path) const {
+    if (!arena) return -1;
+    arena->write(&meta, OFFSET_META, sizeof(metaT));
+    
+    FILE *out = fopen(path, "wb");
+    if (out == nullptr) return -1;
+    
+    int W = arena->dump(out, meta.slot);
+    if (fclose(out) != 0) W = -1;
+    
+    return W;
+}
+
+/* PART: page cache and warm-up */
+void  BPlusTree::enablePageCache (sizeT bytes) {
+    /* the tree of tablespace uses the cache of tablespace */
+    if (arena || space) return;
+    
+    stopWarmUp();
+    pages.reset(new PageCache(bytes));
+}
+
+void  BPlusTree::disablePageCache () {
+    stopWarmUp();
+    if (space) return;
+    pages.reset();
+}
+
+/* list of hot pages: count, slot of the tree (at saving), pages */
+int  BPlusTree::saveHotPages () const {
+    if (!pages || space) return -1;
+    
+    std::vector<PageCache::pageT> hot = pages->hot();
+    uint64_t count = hot.size();
+    
+    FILE *out = fopen(hotPath().c_str(), "wb");
+    if (out == nullptr) return -1;
+    
+    int W = 0;
+    if (fwrite(&count, sizeof(count), 1, out) != 1 || fwrite(&meta.slot, sizeof(offT), 1, out) != 1) W = -1;
+    if (W == 0 && count && fwrite(hot.data(), sizeof(PageCache::pageT), count, out) != count) W = -1;
+    if (fclose(out) != 0) W = -1;
+    
+    return W;
+}
+
+/* MARK: the list isn't checked against the tree -- it's only a hint: */
+/* every page is read from the file again, so a stale list costs only useless reads */
+void  BPlusTree::warmUp (bool eager) {
+    if (!pages) return;
+    stopWarmUp();
+    
+    if (eager) {
+        openFile();
+        std::vector<offT> level(1, meta.rootOffset), lower;
+        for (sizeT h = 0; h < meta.height; ++h) {
+            nodeT node;
+            
+            lower.clear();
+            for (offT off : level) {
+                if (map(&node, off) != 0) continue;
+                pages->insert(off, &node, sizeof(nodeT), true);
+                
+                /* the lowest internal level points to leafs */
+                if (h + 1 < meta.height)
+                    for (indexT *i = begin(node); i != end(node); ++i) lower.push_back(i->child);
+            }
+            level.swap(lower);
+        }
+        closeFile();
+    }
+    
+    /* the hot list is kept for own file only (blocks of tablespace are shared) */
+    if (space) return;
+    
+    FILE *in = fopen(hotPath().c_str(), "rb");
+    if (in == nullptr) return;
+    
+    uint64_t count = 0;
+    offT slot = 0;
+    std::vector<PageCache::pageT> hot;
+    if (fread(&count, sizeof(count), 1, in) == 1 && fread(&slot, sizeof(offT), 1, in) == 1) {
+        hot.resize(count);
+        if (fread(hot.data(), sizeof(PageCache::pageT), count, in) != count) hot.clear();
+    }
+    fclose(in);
+    
+    /* the tree was made again after the list --> the list is about other tree */
+    if (slot > meta.slot) hot.clear();
+    
+    /* pages outside of the tree are dropped */
+    hot.erase(std::remove_if(hot.begin(), hot.end(), [this] (const PageCache::pageT &page) {
+        return page.offset < offT(OFFSET_BLOCK) || page.offset + offT(page.size) > meta.slot;
+    }), hot.end());
+    if (hot.empty()) return;
+    
+    stopPrefetch = false;
+    prefetcher = std::thread(&BPlusTree::prefetch, this, std::move(hot));
+}
+
+/* reading the hot pages by own descriptor (the tree can be used at the same time) */
+void  BPlusTree::prefetch (std::vector<PageCache::pageT> hot) const {
+    int fd = open(filePath, O_RDONLY);
+    if (fd < 0) return;
+    
+    std::vector<char> block;
+    for (PageCache::pageT &page : hot) {
+        if (stopPrefetch) break;
+        
+        /* the page read before a write of the file can be stale --> it's dropped by the cache */
+        uint64_t since = pages->getVersion();
+        block.resize(page.size);
+        ssize_t R = pread(fd, block.data(), page.size, page.offset);
+        
+        /* leaf page can be compressed (and shorter), the cache keeps it plain */
+        if (page.size == LEAF_PAGE_SIZE && R >= ssize_t(PACKED_HEADER)) {
+            uint32_t heap;
+            memcpy(&heap, block.data() + SIZEWITHNOCHILD, sizeof(heap));
+            
+            if (heap & PACKED_MARK) {
+                sizeT packed = heap & ~PACKED_MARK;
+                if (packed > sizeT(R) - PACKED_HEADER) continue;
+                
+                std::vector<char> data(block.begin() + PACKED_HEADER, block.begin() + PACKED_HEADER + packed);
+                if (unpackPage(block.data(), data.data(), packed) != 0) continue;
+                R = LEAF_PAGE_SIZE;
+            }
+        }
+        
+        if (R == ssize_t(page.size)) pages->prefetched(page.offset, block.data(), page.size, since);
+    }
+    close(fd);
+}
+
+void  BPlusTree::stopWarmUp () {
+    if (!prefetcher.joinable()) return;
+    
+    stopPrefetch = true;
+    prefetcher.join();
+}
+
+/* PART: compression of leafs */
+/* MARK: once enabled, the file can keep compressed pages (they are read by the size) even after disabling */
+void  BPlusTree::enableCompression () {
+    if (arena) return;
+    
+    meta.flags |= META_COMPRESS | META_PACKED;
+    unmap(&meta, metaOffset);
+}
+
+void  BPlusTree::disableCompression () {
+    meta.flags &= ~sizeT(META_COMPRESS);
+    unmap(&meta, metaOffset);
+}
+
+/* Runtime statistics (fill of levels is counted by walking the whole tree) */
+BPlusTree::statsT  BPlusTree::getStats (bool withFill) const {
+    statsT stats;
+    stats.ops = metrics.snapshot();
+    stats.cache = cacheStats();
+    stats.pages = pages ? pages->getStats() : PageCache::statsT();
+    if (!withFill) return stats;
+    
+    openFile();
+    std::vector<offT> level(1, meta.rootOffset), lower;
+    for (sizeT h = 0; h < meta.height; ++h) {
+        sizeT used = 0;
+        nodeT node;
+        
+        lower.clear();
+        for (offT off : level) {
+            map(&node, off);
+            used += node.countChilds;
+            for (indexT *i = begin(node); i != end(node); ++i) lower.push_back(i->child);
+        }
+        
+        stats.fill.push_back(double(used) / (level.size() * meta.order));
+        level.swap(lower);
+    }
+    
+    /* the last level is leafs (lower of the last internal level) */
+    sizeT used = 0;
+    leafT leaf;
+    for (offT off : level) {
+        map(&leaf, off);
+        used += fill(leaf);
+    }
+    stats.fill.push_back(double(used) / (level.size() * LEAF_CAPACITY));
+    closeFile();
+    
+    return stats;
+}
+
+void  BPlusTree::resetStats () {
+    metrics.reset();
+    if (cache) cache->resetStats();
+    if (pages) pages->resetStats();
+}
+
+/* Filling the filter with the keys of all leafs */
+/* the filter is made for the counted keys at least (records per leaf vary by their size) */
+void  BPlusTree::buildFilter (sizeT expected) {
+    std::vector<size_t> hashes;
+    
+    openFile();
+    leafT leaf;
+    for (offT off = meta.leafOffset; off != 0; off = leaf.next) {
+        map(&leaf, off);
+        for (recordT *r = begin(leaf); r != end(leaf); ++r) hashes.push_back(keyHash(r->key));
+    }
+    closeFile();
+    
+    filter.reset(new BloomFilter(std::max(expected, hashes.size()), filterRate));
+    for (size_t h : hashes) filter->add(h);
+}
+
+void  BPlusTree::enableFilter (sizeT expected, double rate) {
+    filterRate = rate;
+    buildFilter(expected);
 }
 
 /* Searching index(offset) of key */
@@ -161,37 +957,55 @@ BPlusTree::BPlusTree (const char *newPath, bool forceEmpty) : F(nullptr), fileLe
     sizeT height = meta.height;
     
     while (height > 1) {
-        nodeT node; map(&node, off);
-        
-        indexT *ind = std::upper_bound(begin(node), end(node) - 1, key);
-        
-        off = ind->child;
+        off = searchLeaf(off, key);
         --height;
     }
     
     return off;
 }
-/* Searching index(offset) of leaf */
+/* Searching index(offset) of leaf (the node isn't copied in memory) */
 offT  BPlusTree::searchLeaf (offT index, const keyT &key) const {
-    nodeT node; map(&node, index);
+    alignas(nodeT) char buffer[sizeof(nodeT)];
+    const nodeT *node = nodeAt(index, buffer);
+    assert(node != nullptr);
     
-    indexT *ind = std::upper_bound(begin(node), end(node) - 1, key);
+    const indexT *ind = std::upper_bound(node->child, node->child + node->countChilds - 1, key);
     return ind->child;
 }
 
 /* Searching leaf by key */
  int  BPlusTree::search (const keyT &key, valueT *value) const {
-    leafT leaf; map(&leaf, searchLeaf(key));
+    Metrics::timerT timer(metrics, Metrics::SEARCH);
     
-    recordT *record = find(leaf, key);
-    if (record != leaf.child + leaf.countChilds) {
-        *value = record->value;
-        return keycmp(record->key, key);
-    } else return -1;
+    if (key.overlong() || filtered(key)) return -1;
+    
+    /* hot key is answered without descending */
+    if (cache && cache->get(key.K, value)) return 0;
+    
+    /* binary search by the slots of page, only the found record is unpacked */
+    char buffer[LEAF_PAGE_SIZE];
+    const char *page = pageAt(searchLeaf(key), buffer);
+    if (page == nullptr) return -1;
+    
+    sizeT count = pageCount(page);
+    if (count > LEAF_ORDER) return -1;
+    
+    sizeT i = lowerBound(page, count, key);
+    if (i == count) return -1;
+    
+    recordT record;
+    if (unpackRecord(record, page, pageSlot(page, i), false) != 0) return -1;
+    *value = record.value;
+    
+    int R = keycmp(record.key, key);
+    if (cache && R == 0) cache->put(key.K, record.value);
+    return R;
 }
 /* Searching values by key[left:right] */
  int  BPlusTree::searchSegment (keyT *left, const keyT &right, valueT *values, sizeT max, bool *next) const {
-    if (left == nullptr || keycmp(*left, right) > 0)
+    Metrics::timerT timer(metrics, Metrics::SEARCH_SEGMENT);
+    
+    if (left == nullptr || left->overlong() || right.overlong() || keycmp(*left, right) > 0)
         return -1;
     
     offT offLeft = searchLeaf(*left);
@@ -245,11 +1059,145 @@ offT  BPlusTree::searchLeaf (offT index, const keyT &key) const {
     
     return int(k);
 }
+/* Collecting the separators of [a, b] (ascending) */
+/* goes down level by level while there are not enough separators for "parts" */
+void  BPlusTree::splitSegment (const keyT &a, const keyT &b, sizeT parts, std::vector<keyT> &bounds) const {
+    bounds.clear();
+    if (parts < 2) return;
+    
+    std::vector<offT> level(1, meta.rootOffset), lower;
+    std::vector<keyT> found;
+    
+    for (sizeT height = meta.height; height > 0; --height) {
+        lower.clear();
+        
+        for (offT off : level) {
+            nodeT node; map(&node, off);
+            
+            /* child[i] keeps keys of [child[i-1].key, child[i].key) */
+            for (indexT *ind = begin(node); ind != end(node); ++ind) {
+                bool last = ind == end(node) - 1;
+                
+                if (ind != begin(node)) {
+                    const keyT &low = (ind - 1)->key;
+                    if (keycmp(low, b) > 0) break;
+                    if (keycmp(low, a) > 0) found.push_back(low);
+                }
+                
+                if (last || keycmp(ind->key, a) > 0) lower.push_back(ind->child);
+            }
+        }
+        
+        /* separators of the upper levels are kept */
+        std::sort(found.begin(), found.end(), [] (const keyT &l, const keyT &r) {return keycmp(l, r) < 0;});
+        found.erase(std::unique(found.begin(), found.end(), [] (const keyT &l, const keyT &r) {return keycmp(l, r) == 0;}), found.end());
+        
+        if (found.size() + 1 >= parts) break;
+        level.swap(lower);
+    }
+    
+    /* taking "parts - 1" separators evenly */
+    if (found.size() + 1 <= parts) {
+        bounds.swap(found);
+        return;
+    }
+    for (sizeT i = 1; i < parts; ++i)
+        bounds.push_back(found[i * found.size() / parts]);
+}
+
+/* Scanning one part of the segment */
+sizeT  BPlusTree::scanPart (offT off, const keyT &a, const keyT &b, bool closed, sizeT part, const scanT &consumer) const {
+    sizeT k = 0;
+    bool first = true;
+    
+    leafT leaf;
+    while (off != 0) {
+        if (pmap(&leaf, off) != 0) break;
+        
+        recordT *from = first ? find(leaf, a) : begin(leaf);
+        recordT *to = closed ? std::upper_bound(from, end(leaf), b) : std::lower_bound(from, end(leaf), b);
+        
+        if (from != to) consumer(part, from, to);
+        k += to - from;
+        
+        /* the end of the part is in this leaf */
+        if (to != end(leaf)) break;
+        
+        off = leaf.next;
+        first = false;
+    }
+    
+    return k;
+}
+
+/* Scanning [a, b] by parts on the pool */
+int  BPlusTree::scanParallel (const keyT &a, const keyT &b, const scanT &consumer, sizeT threads) const {
+    if (a.overlong() || b.overlong() || keycmp(a, b) > 0) return -1;
+    
+    ThreadPool pool(threads);
+    
+    openFile();
+    
+    /* more parts than workers --> idle workers steal the rest */
+    std::vector<keyT> bounds;
+    splitSegment(a, b, pool.size() * 4, bounds);
+    
+    /* the first leafs of all parts are found before the workers start (the descent opens the file) */
+    std::vector<offT> starts;
+    for (sizeT i = 0; i <= bounds.size(); ++i) starts.push_back(searchLeaf(i == 0 ? a : bounds[i - 1]));
+    
+    std::vector<sizeT> counts(bounds.size() + 1, 0);
+    for (sizeT i = 0; i <= bounds.size(); ++i) {
+        const keyT &low = i == 0 ? a : bounds[i - 1];
+        const keyT &high = i == bounds.size() ? b : bounds[i];
+        bool closed = i == bounds.size();
+        offT off = starts[i];
+        
+        pool.submit([this, off, &low, &high, closed, i, &consumer, &counts] {
+            counts[i] = scanPart(off, low, high, closed, i, consumer);
+        });
+    }
+    pool.wait();
+    
+    closeFile();
+    
+    sizeT k = 0;
+    for (sizeT c : counts) k += c;
+    return int(k);
+}
+
+/* Searching values by key[a:b] in parallel (merged in order) */
+int  BPlusTree::searchSegmentParallel (const keyT &a, const keyT &b, std::vector<valueT> &values, sizeT threads) const {
+    Metrics::timerT timer(metrics, Metrics::SEARCH_SEGMENT);
+    
+    /* map's nodes don't move while other parts are added */
+    std::map<sizeT, std::vector<valueT>> parts;
+    std::mutex lock;
+    
+    int k = scanParallel(a, b, [&parts, &lock] (sizeT part, const recordT *from, const recordT *to) {
+        std::vector<valueT> *chunk;
+        {
+            std::lock_guard<std::mutex> guard(lock);
+            chunk = &parts[part];
+        }
+        for (; from != to; ++from) chunk->push_back(from->value);
+    }, threads);
+    
+    values.clear();
+    if (k < 0) return k;
+    
+    values.reserve(k);
+    for (auto &chunk : parts)
+        for (valueT &value : chunk.second) values.push_back(value);
+    
+    return k;
+}
+
 /* reset parents of nodes[begin:end] */
 void  BPlusTree::resetIndexChildParent (indexT *begin, indexT *end, offT parent) {
     nodeT node;
     while (begin != end) {
-        map(&node, begin->child);
+        map(&node, begin->child, SIZEWITHNOCHILD);
         node.parent = parent;
         unmap(&node, begin->child, SIZEWITHNOCHILD);
         ++begin;
@@ -259,15 +1207,29 @@ void  BPlusTree::resetIndexChildParent (indexT *begin, indexT *end, offT parent)
 /* change leaf[key] to value */
 int  BPlusTree::update(const keyT& key, valueT value)
 {
-    offT offset = searchLeaf(key);
+    return update(key, [&value] (valueT &v) {v = value;});
+}
+/* change leaf[key] in place */
+int  BPlusTree::update (const keyT &key, const std::function<void (valueT &)> &change) {
+    Metrics::timerT timer(metrics, Metrics::UPDATE);
+    
+    if (key.overlong() || filtered(key)) return -1;
+    if (cache) cache->erase(key.K);
+    
+    offT parent = searchIndex(key);
+    offT offset = searchLeaf(parent, key);
     leafT leaf;
     map(&leaf, offset);
     
     recordT *record = find(leaf, key);
     if (record != leaf.child + leaf.countChilds)
         if (keycmp(key, record->key) == 0) {
-            record->value = value;
-            unmap(&leaf, offset);
+            change(record->value);
+            record->dirty = true;
+            
+            /* bigger value can overfill the leaf */
+            if (fill(leaf) > LEAF_CAPACITY) splitLeaf(parent, offset, leaf);
+            else unmapChilds(&leaf, offset, record, record + 1);
             
             return 0;
         } else {
@@ -286,7 +1248,7 @@ void  BPlusTree::changeChildParent (offT parent, const keyT &old, const keyT &ne
     assert(indNode != node.child + node.countChilds);
     
     indNode->key = newKey;
-    unmap(&node, parent);
+    unmapChilds(&node, parent, indNode, indNode + 1);
     
     if (indNode == node.child + node.countChilds - 1)
         changeChildParent(node.parent, old, newKey);
@@ -298,18 +1260,16 @@ bool  BPlusTree::borrowKey(bool fromRight, leafT &borrower)
     leafT lender;
     map(&lender, lender_off);
     
-    assert(lender.countChilds >= meta.order / 2);
-    if (lender.countChilds != meta.order / 2) {
-        typename leafT::childT whereToLend = nullptr, whereToPut;
-        
+    typename leafT::childT whereToLend = fromRight ? begin(lender) : end(lender) - 1, whereToPut;
+    
+    /* lender must stay full enough */
+    if (lender.countChilds > 1 && fill(lender) - charge(*whereToLend) >= LEAF_MIN) {
         /* decide offset and update parent's key */
         if (fromRight) {
-            whereToLend = begin(lender);
             whereToPut = end(borrower);
             changeChildParent(borrower.parent, begin(borrower)->key,
                               lender.child[1].key);
         } else {
-            whereToLend = end(lender) - 1;
             whereToPut = begin(borrower);
             changeChildParent(lender.parent, begin(lender)->key,
                               whereToLend->key);
@@ -324,6 +1284,7 @@ bool  BPlusTree::borrowKey(bool fromRight, leafT &borrower)
         std::copy(whereToLend + 1, end(lender), whereToLend);
         lender.countChilds--;
         unmap(&lender, lender_off);
+        metrics.add(Metrics::BORROWS);
         return true;
     }
     
@@ -376,6 +1337,7 @@ bool  BPlusTree::borrowKey (bool fromRight, nodeT &from, offT off) {
         --lender.countChilds;
         
         unmap(&lender, offLender);
+        metrics.add(Metrics::BORROWS);
         return true;
     }
     
@@ -390,12 +1352,14 @@ void  BPlusTree::mergeKeys(indexT *where,
     std::copy(begin(next), end(next), end(node));
     node.countChilds += next.countChilds;
     removeNode(&node, &next);
+    metrics.add(Metrics::MERGES);
 }
 
 void  BPlusTree::mergeLeafs(leafT *left, leafT *right)
 {
     std::copy(begin(*right), end(*right), end(*left));
     left->countChilds += right->countChilds;
+    metrics.add(Metrics::MERGES);
 }
 
 void  BPlusTree::removeFromIndex (offT off, nodeT &node, const keyT &key) {
@@ -419,7 +1383,7 @@ void  BPlusTree::removeFromIndex (offT off, nodeT &node, const keyT &key) {
         unalloc(&node, meta.rootOffset);
         meta.height -= 1;
         meta.rootOffset = node.child[0].child;
-        unmap(&meta, OFFSET_META);
+        unmap(&meta, metaOffset);
         return;
     }
     
@@ -470,10 +1434,14 @@ void  BPlusTree::removeFromIndex (offT off, nodeT &node, const keyT &key) {
         }
         else unmap(&node, off);
     }
-    else unmap(&node, off);
+    else unmapChilds(&node, off, delet, end(node));
 }
 
 int  BPlusTree::remove (const keyT &key) {
+    Metrics::timerT timer(metrics, Metrics::REMOVE);
+    
+    if (key.overlong() || filtered(key)) return -1;
+    
     nodeT parent;
     leafT leaf;
     
@@ -489,35 +1457,42 @@ int  BPlusTree::remove (const keyT &key) {
     /* checking */
     if (!std::binary_search(begin(leaf), end(leaf), key)) return -1;
     
-    sizeT minCount;
-    if (meta.countLeaf == 1) minCount = 0;
-    else minCount = meta.order / 2;
+    sizeT minFill;
+    if (meta.countLeaf == 1) minFill = 0;
+    else minFill = LEAF_MIN;
     
-    assert(leaf.countChilds >= minCount && leaf.countChilds <= meta.order);
+    assert(fill(leaf) <= LEAF_CAPACITY);
     
     /* removing the key */
+    if (filter) filter->erase(keyHash(key));
+    if (cache) cache->erase(key.K);
     recordT *delet = find(leaf, key);
     std::copy(delet + 1, end(leaf), delet);
     --leaf.countChilds;
     
     /* merging (borrowing) */
-    if (leaf.countChilds < minCount) {
-        bool done = false;
+    if (fill(leaf) < minFill) {
+        bool borrowed = false;
         
-        /* borrow from left */
+        /* borrow from left (record by record while the leaf is underfull) */
         if (leaf.prev != 0)
-            done = borrowKey(false, leaf);
+            while (fill(leaf) < minFill && borrowKey(false, leaf)) borrowed = true;
         
-        /* borrow from right */
-        if (!done && leaf.next != 0)
-            done = borrowKey(true, leaf);
+        /* borrow from right (the empty leaf can't find its parent key) */
+        if (leaf.next != 0 && leaf.countChilds > 0)
+            while (fill(leaf) < minFill && borrowKey(true, leaf)) borrowed = true;
+        
+        bool done = fill(leaf) >= minFill;
         
         /* merge */
         if (!done) {
             assert(leaf.next != 0 || leaf.prev != 0);
             
+            /* borrowing changed the parent keys */
+            if (borrowed) map(&parent, parentOff);
+            
             keyT k;
-            if (where == end(parent) - 1) {
+            if (off == (end(parent) - 1)->child) {
                 /* leaf is last --> merge prev-leaf */
                 assert(leaf.prev != 0);
                 leafT prev;
@@ -532,7 +1507,7 @@ int  BPlusTree::remove (const keyT &key) {
                 assert(leaf.next != 0);
                 leafT next;
                 map(&next, leaf.next);
-                k = begin(leaf)->key;
+                k = leaf.countChilds ? begin(leaf)->key : key;
                 
                 mergeLeafs(&leaf, &next);
                 removeNode(&leaf, &next);
@@ -544,13 +1519,15 @@ int  BPlusTree::remove (const keyT &key) {
         }
         else unmap(&leaf, off);
     }
-    else unmap(&leaf, off);
+    else unmapChilds(&leaf, off, delet, end(leaf));
     
     return 0;
 }
 
 template <class T>
 void  BPlusTree::createNode (offT off, T *node, T *next) {
+    metrics.add(Metrics::SPLITS);
+    
     /* new brother */
     next->parent = node->parent;
     next->next = node->next;
@@ -565,7 +1542,7 @@ void  BPlusTree::createNode (offT off, T *node, T *next) {
         unmap(&oldNext, next->next, SIZEWITHNOCHILD);
     }
     
-    unmap(&meta, OFFSET_META);
+    unmap(&meta, metaOffset);
 }
 
 template <class T>
@@ -579,7 +1556,7 @@ void  BPlusTree::removeNode (T *prev, T *node) {
         next.prev = node->prev;
         unmap(&next, node->next, SIZEWITHNOCHILD);
     }
-    unmap(&meta, OFFSET_META);
+    unmap(&meta, metaOffset);
 }
 
 void  BPlusTree::insertKeyToIndex (offT off, const keyT &key, offT old, offT after) {
@@ -596,7 +1573,7 @@ void  BPlusTree::insertKeyToIndex (offT off, const keyT &key, offT old, offT aft
         root.child[0].child = old;
         root.child[1].child = after;
         
-        unmap(&meta, OFFSET_META);
+        unmap(&meta, metaOffset);
         unmap(&root, meta.rootOffset);
         
         resetIndexChildParent(begin(root), end(root), meta.rootOffset);
@@ -637,20 +1614,49 @@ void  BPlusTree::insertKeyToIndex (offT off, const keyT &key, offT old, offT aft
         
         insertKeyToIndex(node.parent, midKey, off, node.next);
     } else {
-        insertKeyToIndexNoSplit(node, key, after); unmap(&node, off);
+        indexT *where = insertKeyToIndexNoSplit(node, key, after);
+        unmapChilds(&node, off, where, end(node));
     }
 }
 
-void  BPlusTree::insertRecordNoSplit (leafT *leaf, const keyT &key, const valueT &value) {
+recordT  *BPlusTree::insertRecordNoSplit (leafT *leaf, const keyT &key, const valueT &value) {
     recordT *where = std::upper_bound(begin(*leaf), end (*leaf), key);
     std::copy_backward(where, end(*leaf), end(*leaf) + 1);
     
     where->key = key;
     where->value = value;
+    where->cell = where->room = 0;
+    where->overflow = 0;
+    where->dirty = true;
     ++leaf->countChilds;
+    
+    return where;
 }
 
-void  BPlusTree::insertKeyToIndexNoSplit (nodeT &node, const keyT &key, offT value) {
+/* Splitting overfull leaf by bytes */
+void  BPlusTree::splitLeaf (offT parent, offT off, leafT &leaf) {
+    leafT new_leaf;
+    createNode(off, &leaf, &new_leaf);
+    
+    // find even split point
+    sizeT point = splitPoint(leaf);
+    
+    // split
+    std::copy(leaf.child + point, leaf.child + leaf.countChilds,
+              new_leaf.child);
+    new_leaf.countChilds = leaf.countChilds - point;
+    leaf.countChilds = point;
+    
+    // save leafs
+    unmap(&leaf, off);
+    unmap(&new_leaf, leaf.next);
+    
+    // insert new index key
+    insertKeyToIndex(parent, new_leaf.child[0].key,
+                     off, leaf.next);
+}
+
+indexT  *BPlusTree::insertKeyToIndexNoSplit (nodeT &node, const keyT &key, offT value) {
     indexT *where = std::upper_bound(begin(node), end(node) - 1, key);
     
     /* moving index forward */
@@ -662,53 +1668,39 @@ void  BPlusTree::insertKeyToIndexNoSplit (nodeT &node, const keyT &key, offT val
     (where + 1)->child = value;
     
     ++node.countChilds;
+    
+    return where;
 }
 
 int  BPlusTree::insert (const keyT &key, valueT value) {
+    Metrics::timerT timer(metrics, Metrics::INSERT);
+    
+    if (key.overlong()) return -1;
+    
     offT parent = searchIndex(key);
     offT off = searchLeaf(parent, key);
     leafT leaf;
     map(&leaf, off);
     
-    /* have the same key? */
-    if (std::binary_search(begin(leaf), end(leaf), key)) return 1;
+    /* have the same key? (the filter can say "no" without searching) */
+    if (!filtered(key) && std::binary_search(begin(leaf), end(leaf), key)) return 1;
     
-    if (leaf.countChilds == meta.order) {
+    if (filter) filter->add(keyHash(key));
+    
+    /* the leaf can be overfull for a moment (child has a place for it) */
+    recordT *where = insertRecordNoSplit(&leaf, key, value);
+    
+    if (fill(leaf) > LEAF_CAPACITY) {
         /* spliting (because full leaf) */
-        
-        leafT new_leaf;
-        createNode(off, &leaf, &new_leaf);
-        
-        // find even split point
-        size_t point = leaf.countChilds / 2;
-        bool place_right = keycmp(key, leaf.child[point].key) > 0;
-        if (place_right)
-            ++point;
-        
-        // split
-        std::copy(leaf.child + point, leaf.child + leaf.countChilds,
-                  new_leaf.child);
-        new_leaf.countChilds = leaf.countChilds - point;
-        leaf.countChilds = point;
-        
-        // which part do we put the key
-        if (place_right)
-            insertRecordNoSplit(&new_leaf, key, value);
-        else
-            insertRecordNoSplit(&leaf, key, value);
-        
-        // save leafs
-        unmap(&leaf, off);
-        unmap(&new_leaf, leaf.next);
-        
-        // insert new index key
-        insertKeyToIndex(parent, new_leaf.child[0].key,
-                         off, leaf.next);
+        splitLeaf(parent, off, leaf);
     } else {
-        insertRecordNoSplit(&leaf, key, value);
-        unmap(&leaf, off);
+        /* only the shifted records and the new cell are written */
+        unmapChilds(&leaf, off, where, end(leaf));
     }
     
+    /* too many keys for the filter --> it's rebuilt bigger */
+    if (filter && filter->overloaded()) buildFilter(2 * filter->size());
+    
     return 0;
 }
 
@@ -4,7 +4,21 @@
 #include <iostream>
 #include <string>
 #include <assert.h>
+#include <stdint.h>
+#include <string.h>
+#include <strings.h>
+#include <unistd.h>
+#include <algorithm>
+#include <functional>
 #include <vector>
+#include <memory>
+#include <thread>
+#include <atomic>
+#include "BloomFilter.hpp"
+#include "Arena.hpp"
+#include "LookupCache.hpp"
+#include "Metrics.hpp"
+#include "PageCache.hpp"
 
 class Entry {
 public:
@@ -36,19 +50,34 @@ public:
 namespace BPT {
 
 #define TREE_ORDER 20
+#define KEY_SIZE 64 // key is shorter than KEY_SIZE
+#define LEAF_PAGE_SIZE 4096 // leaf is a slotted page on the disk
+#define LEAF_ORDER 128 // max count of records in the leaf
 #define OFFSET_META 0
 #define OFFSET_BLOCK OFFSET_META + sizeof(metaT)
-#define SIZEWITHNOCHILD sizeof(leafT) - TREE_ORDER * sizeof(recordT)
+#define META_COMPRESS 1 // leaf pages are written compressed
+#define META_PACKED 2 // file can have compressed leaf pages
+#define SIZEWITHNOCHILD (3 * sizeof(offT) + sizeof(sizeT)) // parent, next, prev, countChilds
 
+// MARK: values are saved by packValue/unpackValue (see in "BPlusTree.cpp"), change them together
 typedef Entry valueT;
 
 // key struct
 struct keyT {
-    char K[20];
+    char K[KEY_SIZE];
     
     keyT (const char *str = "") {
         bzero(K, sizeof(K));
-        strcpy(K, str);
+        
+        /* longer key isn't cut (it would be the same as other key): it's marked, and the tree rejects it */
+        size_t length = strlen(str);
+        if (length < sizeof(K)) memcpy(K, str, length);
+        else K[KEY_SIZE - 1] = 1;
+    }
+    
+    // key of KEY_SIZE chars or longer
+    bool overlong () const {
+        return K[KEY_SIZE - 1] != 0;
     }
     
     operator bool () const {
@@ -63,6 +92,16 @@ inline int keycmp (const keyT &a, const keyT &b) {
     return delta == 0 ? strcmp(a.K, b.K) : delta;
 }
 
+// key hash (FNV-1a)
+inline size_t keyHash (const keyT &key) {
+    size_t h = 14695981039346656037ULL;
+    for (const char *c = key.K; *c; ++c) {
+        h ^= (unsigned char)*c;
+        h *= 1099511628211ULL;
+    }
+    return h;
+}
+
 // some operators of comparing
 #define keycmpOperator(type) \
     bool operator < (const keyT &l, const type &r) {\
@@ -105,16 +144,24 @@ struct nodeT {
 struct recordT {
     keyT key;
     valueT value;
+    
+    // place of the record on its page (not saved)
+    uint16_t cell = 0; // offset of the cell
+    uint16_t room = 0; // size of the cell
+    offT overflow = 0; // first overflow page of big value
+    bool dirty = false; // cell must be written again
 };
 
-// leaf block
+// leaf block (unpacked slotted page)
 struct leafT {
     typedef recordT *childT;
     
     offT parent;
     offT next, prev;
     sizeT countChilds;
-    recordT child[TREE_ORDER];
+    recordT child[LEAF_ORDER + 1]; // + 1 for the record before split
+    
+    uint32_t heap = 0; // start of the cells on the page (0 --> page isn't read)
 };
 
 // info of b+ tree
@@ -128,8 +175,12 @@ typedef struct {
     offT slot; // place of storing new block
     offT rootOffset; // place of root of internal nodes
     offT leafOffset; // place of the first leaf
+    sizeT countOverflow; // count of overflow pages (big values)
+    sizeT flags; // META_COMPRESS, META_PACKED
 } metaT;
 
+class Tablespace;
+
 // b+ tree!
 class BPlusTree {
 private:
@@ -155,9 +206,11 @@ private:
     
     // insert key to the node
     void insertKeyToIndex (offT offset, const keyT &key, offT old, offT after);
-    void insertKeyToIndexNoSplit (nodeT &node, const keyT &key, offT value);
-    // insert to leaf (without split)
-    void insertRecordNoSplit (leafT *leaf, const keyT &key, const valueT &value);
+    indexT *insertKeyToIndexNoSplit (nodeT &node, const keyT &key, offT value);
+    // insert to leaf (without split), returns place of the record
+    recordT *insertRecordNoSplit (leafT *leaf, const keyT &key, const valueT &value);
+    // split overfull leaf
+    void splitLeaf (offT parent, offT offset, leafT &leaf);
     
     // borrow a key from other node
     bool borrowKey (bool fromRight, nodeT &from, offT offset);
@@ -170,6 +223,22 @@ private:
     // change parent key
     void changeChildParent (offT parent, const keyT &old, const keyT &newKey);
     
+    // filter of negative lookups (null --> off)
+    std::unique_ptr<BloomFilter> filter;
+    double filterRate;
+    
+    // cache of hot lookups (null --> off)
+    // MARK: it keeps values, so only changes of values (update, remove) invalidate it, moves of records don't
+    mutable std::unique_ptr<LookupCache<valueT>> cache;
+    
+    // runtime counters (every thread has own ones)
+    mutable Metrics metrics;
+    
+    // filling the filter with all keys (made for "expected" keys, but not less than the count of keys)
+    void buildFilter (sizeT expected);
+    // key is surely absent
+    bool filtered (const keyT &key) const {return filter && !filter->contains(keyHash(key));}
+    
     template <class T> void createNode (offT offset, T *node, T *next);
     template <class T> void removeNode (T *prev, T *node);
     
@@ -178,6 +247,27 @@ private:
     mutable FILE *F;
     mutable int fileLevel;
     
+    // memory of the in-memory tree (null --> tree is in the file)
+    std::unique_ptr<Arena> arena;
+    
+    // tablespace of the tree (null --> tree has own file): file, allocator and page cache are shared
+    Tablespace *space;
+    offT metaOffset; // place of "meta" in the file
+    
+    friend class Tablespace;
+    BPlusTree (Tablespace *space, offT metaOffset, bool create);
+    
+    // cache of blocks of the file (null --> off), it's shared by the trees of tablespace
+    std::shared_ptr<PageCache> pages;
+    
+    // warm-up: the hot pages of the last session are read in the background
+    std::thread prefetcher;
+    std::atomic<bool> stopPrefetch;
+    
+    void prefetch (std::vector<PageCache::pageT> hot) const;
+    void stopWarmUp ();
+    std::string hotPath () const {return std::string(filePath) + ".hot";}
+    
     void openFile (const char *mode = "rb+") const;
     void closeFile () const;
     
@@ -192,24 +282,115 @@ private:
     // read block from disk
     int map (void *block, offT offset, sizeT size) const;
     template <class T> int map (T *block, offT offset) const;
+    // whole node (MARK: only nodes and leaf pages are put in the page cache)
+    int map (nodeT *node, offT offset) const;
     
     // write block into disk
     int unmap (void *block, offT offset, sizeT size) const;
     
     template <class T> int unmap (T *block, offT offset) const;
+    // write the header and children [from:to) only (the rest of block isn't changed)
+    template <class T> int unmapChilds (T *block, offT offset, typename T::childT from, typename T::childT to) const;
+    
+    // leafs are slotted pages: (un)packing of page
+    int unpackLeaf (leafT *leaf, const char *page, bool parallel) const;
+    int map (leafT *leaf, offT offset) const;
+    int unmap (leafT *leaf, offT offset);
+    int unmapChilds (leafT *leaf, offT offset, recordT *from, recordT *to);
+    
+    // big values are kept in the chain of overflow pages
+    void unmapValue (recordT &record);
+    offT unmapOverflow (const char *data, sizeT size);
+    int mapOverflow (std::string &data, offT offset, sizeT size, bool parallel) const;
+    
+    // reading past the cache ("parallel" --> positional read)
+    int mapFile (void *block, offT offset, sizeT size, bool parallel) const;
+    // reading the leaf page (decoded if it's compressed)
+    int mapPage (char *page, offT offset, bool parallel) const;
+    
+    // blocks for lookups: in the arena they are read in place (by pointer), else they are read in "buffer"
+    const nodeT *nodeAt (offT offset, void *buffer) const;
+    const char *pageAt (offT offset, char *buffer) const;
+    // record of the cell at "cell" of the page
+    int unpackRecord (recordT &record, const char *page, uint16_t cell, bool parallel) const;
+    
+    // positional read (safe for several threads while the file is opened)
+    int pmap (void *block, offT offset, sizeT size) const;
+    int pmap (leafT *leaf, offT offset) const;
+    
+    // splitting [a, b] by the separators of the upper levels
+    void splitSegment (const keyT &a, const keyT &b, sizeT parts, std::vector<keyT> &bounds) const;
+    
+public:
+    // consumer of the parallel scan: records [begin:end) of the part "part"
+    // MARK: it is called from the workers (parts are in parallel, chunks of one part are in order)
+    typedef std::function<void (sizeT part, const recordT *begin, const recordT *end)> scanT;
+    
+private:
+    // scanning [a, b) (or [a, b] if closed) from the leaf "offset"
+    sizeT scanPart (offT offset, const keyT &a, const keyT &b, bool closed, sizeT part, const scanT &consumer) const;
     
 public:
-    BPlusTree (const char *filePath, bool force = false);
+    BPlusTree (const char *filePath, bool force = false, bool useFilter = false);
+    // in-memory tree (blocks are in the arena, "hugePages" --> slabs on huge pages if the system can)
+    explicit BPlusTree (bool hugePages = false);
+    // MARK: hot pages are saved on close (if the page cache is on and the tree has own file)
+    ~BPlusTree ();
     
     // basic methods of tree
+    // MARK: overlong keys (see keyT::overlong) are rejected: -1
     int search (const keyT &key, valueT *value) const;
     int searchSegment (keyT *a, const keyT &b, valueT *values, sizeT max, bool *next = nullptr) const;
     
+    // parallel scan of [a, b] ("threads" == 0 --> one worker per core)
+    int scanParallel (const keyT &a, const keyT &b, const scanT &consumer, sizeT threads = 0) const;
+    int searchSegmentParallel (const keyT &a, const keyT &b, std::vector<valueT> &values, sizeT threads = 0) const;
+    
     int insert (const keyT &key, valueT value);
     int remove (const keyT &key);
     int update (const keyT &key, valueT value);
+    // change the value in place (only the record is written back)
+    int update (const keyT &key, const std::function<void (valueT &)> &change);
     
     metaT getInfo () const {return meta;}
+    
+    // runtime statistics of the tree
+    struct statsT {
+        Metrics::snapshotT ops;          // operations (count, latency), i/o, splits/merges/borrows
+        LookupCache<valueT>::statsT cache;
+        PageCache::statsT pages;
+        std::vector<double> fill;        // fill per level (root first, leafs last), only if asked
+    };
+    statsT getStats (bool withFill = false) const;
+    void resetStats ();
+    
+    bool inMemory () const {return arena != nullptr;}
+    // writing the in-memory tree out in the file (one sequential write), it can be opened as usual tree
+    int persist (const char *path) const;
+    
+    // filter of absent keys (it's rebuilt from the leafs; "expected" == 0 --> count of leafs' records)
+    void enableFilter (sizeT expected = 0, double rate = 0.01);
+    void disableFilter () {filter.reset();}
+    
+    // cache of "capacity" hot keys for search()
+    void enableCache (sizeT capacity) {cache.reset(new LookupCache<valueT>(capacity));}
+    void disableCache () {cache.reset();}
+    // hits/misses of the cache (zeros if it's off)
+    LookupCache<valueT>::statsT cacheStats () const {return cache ? cache->getStats() : LookupCache<valueT>::statsT();}
+    
+    // cache of "bytes" of whole nodes and leaf pages in front of the file (no use for the in-memory tree)
+    // MARK: the trees of tablespace always use the cache of tablespace
+    void enablePageCache (sizeT bytes);
+    void disablePageCache ();
+    
+    // offsets of the cached pages are saved in "<file>.hot" (on close or by call), warmUp() prefetches them again
+    // "eager" --> all internal levels are loaded (and pinned) before return, the rest is read in the background
+    int saveHotPages () const;
+    void warmUp (bool eager = false);
+    
+    // compression of leaf pages on writing (LZ, see "Compression.hpp"), the setting is saved in the file
+    void enableCompression ();
+    void disableCompression ();
 };
 
 
@@ -0,0 +1,286 @@
+#include "BPlusTree.hpp"
+#include <stdio.h>
+#include <stdlib.h>
+#include <math.h>
+#include <chrono>
+#include <random>
+#include <string>
+#include <vector>
+
+
+// BENCHMARK OF B-PLUS-TREE
+// one result per line (JSON), every workload is measured on its own (stats are reset before it)
+//
+// options:
+//   --keys N      count of keys (100000)
+//   --cache N     capacity of the lookup cache (0 --> off)
+//   --pages B     bytes of the page cache (0 --> off), reopen warms it up
+//   --path P      file of the tree ("bench.db")
+//   --memory      in-memory tree (reopen --> persist + open)
+//   --compress    compression of leaf pages
+//   --seed S      seed of the random workloads (42)
+
+using namespace BPT;
+typedef std::chrono::steady_clock clockT;
+
+/* PART: config */
+struct configT {
+    sizeT keys = 100000;
+    sizeT cache = 0;
+    sizeT pages = 0;
+    std::string path = "bench.db";
+    bool memory = false;
+    bool compress = false;
+    unsigned seed = 42;
+};
+
+/* fixed width, so the order of keys is the order of numbers */
+static keyT makeKey (sizeT k, char prefix = 'k') {
+    char s[KEY_SIZE];
+    snprintf(s, sizeof(s), "%c%011zu", prefix, k);
+    return keyT(s);
+}
+
+static valueT makeValue (sizeT k) {
+    return Entry(std::to_string(1990 + k % 20) + "-01-01", "B" + std::to_string(k % 16), std::to_string(k % 500), "CS");
+}
+
+// zipf(theta) over [0, n): inverse of the cumulative distribution
+class Zipf {
+    std::vector<double> cdf;
+
+public:
+    Zipf (sizeT n, double theta = 0.99) : cdf(n) {
+        double sum = 0;
+        for (sizeT i = 0; i < n; ++i) cdf[i] = (sum += 1.0 / pow(double(i + 1), theta));
+        for (double &c : cdf) c /= sum;
+    }
+    
+    template <class R> sizeT operator () (R &rng) {
+        double u = std::uniform_real_distribution<double>(0, 1)(rng);
+        return std::lower_bound(cdf.begin(), cdf.end(), u) - cdf.begin();
+    }
+};
+
+/* PART: output */
+/* "writes" --> the workload also writes (count and latency of UPDATE are added to the line) */
+static void report (const char *workload, BPlusTree &tree, Metrics::opT op, sizeT ops, double seconds, const configT &config, bool writes = false) {
+    BPlusTree::statsT stats = tree.getStats();
+    const Metrics::snapshotT &s = stats.ops;
+    
+    char updates[256] = "";
+    if (writes)
+        snprintf(updates, sizeof(updates), ",\"update_ops\":%llu,\"update_mean_ns\":%llu,\"update_p50_ns\":%llu,\"update_p99_ns\":%llu",
+                 (unsigned long long)s.count[Metrics::UPDATE], (unsigned long long)s.mean(Metrics::UPDATE),
+                 (unsigned long long)s.percentile(Metrics::UPDATE, 0.5), (unsigned long long)s.percentile(Metrics::UPDATE, 0.99));
+    
+    printf("{\"workload\":\"%s\",\"keys\":%zu,\"cache\":%zu,\"pages\":%zu,\"memory\":%s,\"compress\":%s,\"ops\":%zu,\"seconds\":%.6f,\"ops_per_sec\":%.1f,"
+           "\"mean_ns\":%llu,\"p50_ns\":%llu,\"p99_ns\":%llu,\"p999_ns\":%llu,"
+           "\"page_reads\":%llu,\"page_writes\":%llu,\"bytes_read\":%llu,\"bytes_written\":%llu,"
+           "\"splits\":%llu,\"merges\":%llu,\"borrows\":%llu,\"cache_hits\":%zu,\"cache_misses\":%zu,"
+           "\"page_hits\":%zu,\"page_misses\":%zu%s}\n",
+           workload, config.keys, config.cache, config.pages, config.memory ? "true" : "false", config.compress ? "true" : "false", ops, seconds, seconds > 0 ? ops / seconds : 0.0,
+           (unsigned long long)s.mean(op), (unsigned long long)s.percentile(op, 0.5),
+           (unsigned long long)s.percentile(op, 0.99), (unsigned long long)s.percentile(op, 0.999),
+           (unsigned long long)s.counter[Metrics::PAGE_READS], (unsigned long long)s.counter[Metrics::PAGE_WRITES],
+           (unsigned long long)s.counter[Metrics::BYTES_READ], (unsigned long long)s.counter[Metrics::BYTES_WRITTEN],
+           (unsigned long long)s.counter[Metrics::SPLITS], (unsigned long long)s.counter[Metrics::MERGES],
+           (unsigned long long)s.counter[Metrics::BORROWS], stats.cache.hits, stats.cache.misses,
+           stats.pages.hits, stats.pages.misses, updates);
+    fflush(stdout);
+}
+
+/* running "body" (it returns count of operations) on clean stats */
+template <class F>
+static void measure (const char *workload, BPlusTree &tree, Metrics::opT op, const configT &config, F body, bool writes = false) {
+    tree.resetStats();
+    clockT::time_point start = clockT::now();
+    sizeT ops = body();
+    double seconds = std::chrono::duration<double>(clockT::now() - start).count();
+    report(workload, tree, op, ops, seconds, config, writes);
+}
+
+/* all options of the config (the reopened tree warms the page cache up) */
+static void configure (BPlusTree &tree, const configT &config, bool reopened) {
+    if (config.cache) tree.enableCache(config.cache);
+    if (config.pages) {
+        tree.enablePageCache(config.pages);
+        if (reopened) tree.warmUp(true);
+    }
+    if (config.compress) tree.enableCompression();
+}
+
+static std::unique_ptr<BPlusTree> newTree (const configT &config) {
+    std::unique_ptr<BPlusTree> tree(config.memory ? new BPlusTree() : new BPlusTree(config.path.c_str(), true));
+    configure(*tree, config, false);
+    return tree;
+}
+
+/* PART: workloads */
+static void inserts (const configT &config, Zipf &zipf) {
+    std::mt19937_64 rng(config.seed);
+    
+    std::unique_ptr<BPlusTree> tree = newTree(config);
+    measure("insert_sequential", *tree, Metrics::INSERT, config, [&] {
+        for (sizeT k = 0; k < config.keys; ++k) tree->insert(makeKey(k), makeValue(k));
+        return config.keys;
+    });
+    
+    /* skewed keys: repeated ones are rejected by the tree (they still count as operations) */
+    tree = newTree(config);
+    measure("insert_zipfian", *tree, Metrics::INSERT, config, [&] {
+        for (sizeT i = 0; i < config.keys; ++i) {
+            sizeT k = zipf(rng);
+            tree->insert(makeKey(k), makeValue(k));
+        }
+        return config.keys;
+    });
+}
+
+static void lookups (BPlusTree &tree, const configT &config, Zipf &zipf) {
+    std::mt19937_64 rng(config.seed + 1);
+    std::uniform_int_distribution<sizeT> any(0, config.keys - 1);
+    valueT value;
+    
+    measure("lookup_hit", tree, Metrics::SEARCH, config, [&] {
+        for (sizeT i = 0; i < config.keys; ++i) tree.search(makeKey(any(rng)), &value);
+        return config.keys;
+    });
+    measure("lookup_miss", tree, Metrics::SEARCH, config, [&] {
+        for (sizeT i = 0; i < config.keys; ++i) tree.search(makeKey(any(rng), 'm'), &value);
+        return config.keys;
+    });
+    measure("lookup_zipfian", tree, Metrics::SEARCH, config, [&] {
+        for (sizeT i = 0; i < config.keys; ++i) tree.search(makeKey(zipf(rng)), &value);
+        return config.keys;
+    });
+}
+
+static void scans (BPlusTree &tree, const configT &config) {
+    std::mt19937_64 rng(config.seed + 2);
+    const sizeT lengths[] = {10, 100, 1000};
+    
+    for (sizeT length : lengths) {
+        if (length > config.keys) break;
+        
+        std::uniform_int_distribution<sizeT> from(0, config.keys - length);
+        std::vector<valueT> values(length);
+        sizeT count = std::max<sizeT>(10, std::min<sizeT>(1000, config.keys / length));
+        
+        std::string name = "scan_" + std::to_string(length);
+        measure(name.c_str(), tree, Metrics::SEARCH_SEGMENT, config, [&] {
+            for (sizeT i = 0; i < count; ++i) {
+                sizeT a = from(rng);
+                keyT left = makeKey(a);
+                tree.searchSegment(&left, makeKey(a + length - 1), values.data(), length);
+            }
+            return count;
+        });
+    }
+}
+
+/* "reads" percent of zipfian lookups, the rest -- updates of the same keys (both are reported) */
+static void mixed (BPlusTree &tree, const configT &config, Zipf &zipf, sizeT reads) {
+    std::mt19937_64 rng(config.seed + 3 + reads);
+    valueT value;
+    
+    std::string name = "mixed_read_" + std::to_string(reads);
+    measure(name.c_str(), tree, Metrics::SEARCH, config, [&] {
+        for (sizeT i = 0; i < config.keys; ++i) {
+            sizeT k = zipf(rng);
+            if (rng() % 100 < reads) tree.search(makeKey(k), &value);
+            else tree.update(makeKey(k), makeValue(k + i));
+        }
+        return config.keys;
+    }, true);
+}
+
+/* removing random keys and inserting new ones (count of keys stays the same) */
+static void churn (BPlusTree &tree, const configT &config) {
+    std::mt19937_64 rng(config.seed + 4);
+    std::vector<sizeT> alive(config.keys);
+    for (sizeT k = 0; k < config.keys; ++k) alive[k] = k;
+    sizeT next = config.keys;
+    
+    measure("delete_churn", tree, Metrics::REMOVE, config, [&] {
+        for (sizeT i = 0; i < config.keys; ++i) {
+            sizeT &k = alive[rng() % alive.size()];
+            tree.remove(makeKey(k));
+            k = next++;
+            tree.insert(makeKey(k), makeValue(k));
+        }
+        return config.keys;
+    });
+}
+
+/* opening the tree again (internal levels are loaded, hot pages are prefetched) and the first lookup */
+static void reopen (std::unique_ptr<BPlusTree> &tree, const configT &config) {
+    if (config.memory && tree->persist(config.path.c_str()) != 0) return;
+    tree.reset();
+    
+    clockT::time_point start = clockT::now();
+    tree.reset(new BPlusTree(config.path.c_str()));
+    configure(*tree, config, true);
+    valueT value;
+    tree->search(makeKey(0), &value);
+    double seconds = std::chrono::duration<double>(clockT::now() - start).count();
+    
+    report("reopen", *tree, Metrics::SEARCH, 1, seconds, config);
+    
+    /* lookups right after the restart */
+    std::mt19937_64 rng(config.seed + 5);
+    std::uniform_int_distribution<sizeT> any(0, config.keys - 1);
+    measure("lookup_after_reopen", *tree, Metrics::SEARCH, config, [&] {
+        for (sizeT i = 0; i < config.keys; ++i) tree->search(makeKey(any(rng)), &value);
+        return config.keys;
+    });
+}
+
+/* PART: main */
+int main (int argc, char **argv) {
+    configT config;
+    for (int i = 1; i < argc; ++i) {
+        std::string arg = argv[i];
+        bool more = i + 1 < argc;
+        
+        if (arg == "--keys" && more) config.keys = strtoull(argv[++i], nullptr, 10);
+        else if (arg == "--cache" && more) config.cache = strtoull(argv[++i], nullptr, 10);
+        else if (arg == "--pages" && more) config.pages = strtoull(argv[++i], nullptr, 10);
+        else if (arg == "--path" && more) config.path = argv[++i];
+        else if (arg == "--seed" && more) config.seed = unsigned(strtoul(argv[++i], nullptr, 10));
+        else if (arg == "--memory") config.memory = true;
+        else if (arg == "--compress") config.compress = true;
+        else {
+            fprintf(stderr, "usage: %s [--keys N] [--cache N] [--pages B] [--path P] [--memory] [--compress] [--seed S]\n", argv[0]);
+            return 1;
+        }
+    }
+    if (config.keys == 0) config.keys = 1;
+    
+    Zipf zipf(config.keys);
+    inserts(config, zipf);
+    
+    /* the rest runs on the tree of random inserts */
+    std::mt19937_64 rng(config.seed);
+    std::vector<sizeT> order(config.keys);
+    for (sizeT k = 0; k < config.keys; ++k) order[k] = k;
+    std::shuffle(order.begin(), order.end(), rng);
+    
+    std::unique_ptr<BPlusTree> tree = newTree(config);
+    measure("insert_random", *tree, Metrics::INSERT, config, [&] {
+        for (sizeT k : order) tree->insert(makeKey(k), makeValue(k));
+        return config.keys;
+    });
+    
+    lookups(*tree, config, zipf);
+    scans(*tree, config);
+    mixed(*tree, config, zipf, 90);
+    mixed(*tree, config, zipf, 50);
+    churn(*tree, config);
+    reopen(tree, config);
+    
+    tree.reset();
+    ::remove(config.path.c_str());
+    ::remove((config.path + ".hot").c_str());
+    return 0;
+}
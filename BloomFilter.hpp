@@ -0,0 +1,77 @@
+#ifndef BloomFilter_hpp
+#define BloomFilter_hpp
+
+#include <stdint.h>
+#include <math.h>
+#include <vector>
+
+namespace BPT {
+
+// counting bloom filter (it supports erasing)
+// MARK: contains() == false --> the key is surely absent
+class BloomFilter {
+private:
+    std::vector<uint8_t> counters;
+    size_t hashes;   // count of hash functions
+    size_t count;    // count of keys in the filter
+    size_t capacity; // expected count of keys
+    
+    /* splitmix64: the hash of key is mixed once more, so it doesn't depend on the sharding by the same hash */
+    static uint64_t mix (uint64_t h) {
+        h += 0x9e3779b97f4a7c15ULL;
+        h = (h ^ (h >> 30)) * 0xbf58476d1ce4e5b9ULL;
+        h = (h ^ (h >> 27)) * 0x94d049bb133111ebULL;
+        return h ^ (h >> 31);
+    }
+    
+    /* i-th position (double hashing) */
+    size_t position (uint64_t h1, uint64_t h2, size_t i) const {
+        return size_t((h1 + i * h2) % counters.size());
+    }
+
+public:
+    BloomFilter (size_t expected, double rate = 0.01) : count(0), capacity(expected ? expected : 1) {
+        if (rate <= 0 || rate >= 1) rate = 0.01;
+        
+        /* m = -n ln(p) / ln(2)^2,  k = m / n ln(2) */
+        double m = -double(capacity) * log(rate) / (M_LN2 * M_LN2);
+        counters.assign(size_t(m) + 1, 0);
+        hashes = size_t(m / capacity * M_LN2 + 0.5);
+        if (hashes == 0) hashes = 1;
+    }
+    
+    size_t size () const {return count;}
+    // too many keys --> the rate of false positives grows
+    bool overloaded () const {return count > 2 * capacity;}
+    
+    void add (uint64_t hash) {
+        uint64_t h1 = mix(hash), h2 = mix(h1) | 1;
+        for (size_t i = 0; i < hashes; ++i) {
+            uint8_t &c = counters[position(h1, h2, i)];
+            if (c != UINT8_MAX) ++c;
+        }
+        ++count;
+    }
+    
+    /* MARK: only for a key which was added */
+    void erase (uint64_t hash) {
+        uint64_t h1 = mix(hash), h2 = mix(h1) | 1;
+        for (size_t i = 0; i < hashes; ++i) {
+            uint8_t &c = counters[position(h1, h2, i)];
+            /* saturated counter stays forever */
+            if (c != UINT8_MAX && c != 0) --c;
+        }
+        if (count) --count;
+    }
+    
+    bool contains (uint64_t hash) const {
+        uint64_t h1 = mix(hash), h2 = mix(h1) | 1;
+        for (size_t i = 0; i < hashes; ++i)
+            if (counters[position(h1, h2, i)] == 0) return false;
+        return true;
+    }
+};
+
+}
+
+#endif /* BloomFilter_hpp */
@@ -0,0 +1,127 @@
+#ifndef Compression_hpp
+#define Compression_hpp
+
+#include <stdint.h>
+#include <string.h>
+#include <sys/types.h>
+
+namespace BPT {
+
+// lightweight LZ77 codec of pages (LZ4-like sequences)
+// sequence: token (length of literals << 4 | length of match - 4) | more length | literals | offset (2) | more length
+// MARK: the last sequence has literals only; input is at most 64K (offsets are 2 bytes)
+
+#define LZ_MIN_MATCH 4
+#define LZ_HASH_BITS 12
+
+/* writing of long length: 15 in the token, the rest in bytes of 255 */
+inline bool lzLength (size_t length, char *to, size_t &o, size_t cap) {
+    for (length -= 15; ; length -= 255) {
+        if (o >= cap) return false;
+        to[o++] = char(length < 255 ? length : 255);
+        if (length < 255) return true;
+    }
+}
+
+/* size of compressed "src" (0 --> it doesn't fit in "cap") */
+inline size_t lzCompress (const char *src, size_t n, char *dst, size_t cap) {
+    uint16_t table[1 << LZ_HASH_BITS]; // last position + 1 of 4 bytes with this hash
+    memset(table, 0, sizeof(table));
+    
+    size_t i = 0, anchor = 0, o = 0;
+    
+    /* literals [anchor:i) + match of "match" bytes at "offset" back (match == 0 --> the last sequence) */
+    auto emit = [&] (size_t match, size_t offset) -> bool {
+        size_t literals = i - anchor;
+        size_t extra = match ? match - LZ_MIN_MATCH : 0;
+        if (o >= cap) return false;
+        
+        size_t token = o++;
+        dst[token] = char(((literals < 15 ? literals : 15) << 4) | (extra < 15 ? extra : 15));
+        if (literals >= 15 && !lzLength(literals, dst, o, cap)) return false;
+        
+        if (o + literals > cap) return false;
+        memcpy(dst + o, src + anchor, literals);
+        o += literals;
+        
+        if (match == 0) return true;
+        if (o + 2 > cap) return false;
+        uint16_t back = uint16_t(offset);
+        memcpy(dst + o, &back, sizeof(back));
+        o += sizeof(back);
+        
+        return extra < 15 || lzLength(extra, dst, o, cap);
+    };
+    
+    if (n > 0xFFFF) return 0;
+    while (i + LZ_MIN_MATCH <= n) {
+        uint32_t v;
+        memcpy(&v, src + i, sizeof(v));
+        size_t h = (v * 2654435761u) >> (32 - LZ_HASH_BITS);
+        
+        size_t candidate = table[h];
+        table[h] = uint16_t(i + 1);
+        
+        if (candidate && memcmp(src + candidate - 1, src + i, LZ_MIN_MATCH) == 0) {
+            size_t from = candidate - 1, match = LZ_MIN_MATCH;
+            while (i + match < n && src[from + match] == src[i + match]) ++match;
+            
+            if (!emit(match, i - from)) return 0;
+            i += match;
+            anchor = i;
+        } else ++i;
+    }
+    
+    i = n;
+    return emit(0, 0) ? o : 0;
+}
+
+/* size of decompressed "src" (-1 --> it's broken or doesn't fit in "cap") */
+inline ssize_t lzDecompress (const char *src, size_t n, char *dst, size_t cap) {
+    size_t i = 0, o = 0;
+    
+    /* long length (after 15 in the token) */
+    auto more = [&] (size_t &length) -> bool {
+        uint8_t b;
+        do {
+            if (i >= n) return false;
+            b = uint8_t(src[i++]);
+            length += b;
+        } while (b == 255);
+        return true;
+    };
+    
+    while (i < n) {
+        uint8_t token = uint8_t(src[i++]);
+        
+        size_t literals = token >> 4;
+        if (literals == 15 && !more(literals)) return -1;
+        if (i + literals > n || o + literals > cap) return -1;
+        
+        memcpy(dst + o, src + i, literals);
+        i += literals;
+        o += literals;
+        
+        /* the last sequence */
+        if (i == n) break;
+        
+        uint16_t back;
+        if (i + sizeof(back) > n) return -1;
+        memcpy(&back, src + i, sizeof(back));
+        i += sizeof(back);
+        
+        size_t match = token & 15;
+        if (match == 15 && !more(match)) return -1;
+        match += LZ_MIN_MATCH;
+        if (back == 0 || back > o || o + match > cap) return -1;
+        
+        /* byte by byte: the match can overlap itself */
+        for (size_t k = 0; k < match; ++k, ++o) dst[o] = dst[o - back];
+    }
+    
+    return ssize_t(o);
+}
+
+}
+
+#endif /* Compression_hpp */
@@ -0,0 +1,371 @@
+#include "BPlusTree.hpp"
+#include "ShardedBPlusTree.hpp"
+#include "Tablespace.hpp"
+#include <stdio.h>
+#include <stdlib.h>
+#include <map>
+#include <random>
+#include <string>
+#include <vector>
+
+
+// DIFFERENTIAL TEST OF B-PLUS-TREE
+// random inserts/removes/updates go to the tree and to std::map at once: every result and the whole contents
+// (lookups, segments, parallel scans) must be the same, also after reopening the file
+//
+// usage: bplustree_test MODE [--ops N] [--seed S] [--path P]
+//   file        tree in the file
+//   memory      in-memory tree, persist() + opening as usual tree
+//   compress    compression of leaf pages
+//   pages       page cache (small, so pages are evicted) + warm-up after reopening
+//   filter      Bloom filter of absent keys
+//   cache       lookup cache of hot keys
+//   combined    compression + page cache + filter + lookup cache
+//   tablespace  several trees in one file with the shared page cache
+//   sharded     hash-sharded index (batch writes and merged scans in parallel)
+
+using namespace BPT;
+
+#define CHECK(condition, ...) do { \
+    if (!(condition)) { \
+        fprintf(stderr, "FAILED (%s:%d): ", __FILE__, __LINE__); \
+        fprintf(stderr, __VA_ARGS__); \
+        fprintf(stderr, "\n"); \
+        exit(1); \
+    } \
+} while (0)
+
+/* PART: model */
+/* order of the tree (length first, see keycmp) */
+struct keyLess {
+    bool operator () (const std::string &l, const std::string &r) const {
+        return keycmp(l.c_str(), r.c_str()) < 0;
+    }
+};
+typedef std::map<std::string, valueT, keyLess> modelT;
+
+struct configT {
+    std::string mode;
+    std::string path;
+    sizeT ops = 20000;
+    sizeT keys = 3000;
+    unsigned seed = 7;
+};
+
+/* short and long keys (long ones make the leafs hold less records) */
+static std::string makeKey (sizeT k) {
+    std::string s = std::to_string(k);
+    if (k % 7 == 0) s = std::string(KEY_SIZE - 1 - s.size(), 'x') + s;
+    return s;
+}
+
+static std::string randomString (std::mt19937_64 &rng, sizeT length) {
+    std::string s(length, ' ');
+    for (char &c : s) c = char('a' + rng() % 26);
+    return s;
+}
+
+/* values of every size: empty, short and big ones (they go to overflow pages) */
+static valueT makeValue (std::mt19937_64 &rng) {
+    sizeT birth = rng() % 50 == 0 ? 3000 + rng() % 6000 : rng() % 12;
+    return Entry(randomString(rng, birth), randomString(rng, rng() % 4), randomString(rng, 3), randomString(rng, rng() % 16));
+}
+
+static bool same (const valueT &a, const valueT &b) {
+    return a.birth == b.birth && a.homeBlock == b.homeBlock && a.homeRoom == b.homeRoom && a.fac == b.fac;
+}
+
+static const std::string FIRST_KEY = "";
+static const std::string LAST_KEY(KEY_SIZE - 1, '~');
+
+/* PART: checker of one tree */
+class Checker {
+    std::string name;
+    BPlusTree *tree;
+    modelT model;
+    std::mt19937_64 rng;
+    sizeT keys;
+
+public:
+    Checker (const std::string &n, BPlusTree *t, unsigned seed, sizeT k) : name(n), tree(t), rng(seed), keys(k) {}
+    
+    void attach (BPlusTree *t) {tree = t;}
+    const modelT &contents () const {return model;}
+    
+    /* one random operation */
+    void step () {
+        std::string key = makeKey(rng() % keys);
+        bool present = model.count(key) > 0;
+        valueT value;
+        
+        switch (rng() % 6) {
+            case 0: case 1: {
+                value = makeValue(rng);
+                int R = tree->insert(key.c_str(), value);
+                CHECK(R == (present ? 1 : 0), "%s: insert %s --> %d", name.c_str(), key.c_str(), R);
+                if (!present) model[key] = value;
+                break;
+            }
+            case 2: {
+                int R = tree->remove(key.c_str());
+                CHECK(R == (present ? 0 : -1), "%s: remove %s --> %d", name.c_str(), key.c_str(), R);
+                model.erase(key);
+                break;
+            }
+            case 3: {
+                value = makeValue(rng);
+                int R = tree->update(key.c_str(), value);
+                CHECK((R == 0) == present, "%s: update %s --> %d", name.c_str(), key.c_str(), R);
+                if (present) model[key] = value;
+                break;
+            }
+            case 4: {
+                std::string fac = randomString(rng, rng() % 300);
+                int R = tree->update(key.c_str(), [&fac] (valueT &v) {v.fac = fac;});
+                CHECK((R == 0) == present, "%s: update in place %s --> %d", name.c_str(), key.c_str(), R);
+                if (present) model[key].fac = fac;
+                break;
+            }
+            default: {
+                int R = tree->search(key.c_str(), &value);
+                CHECK((R == 0) == present, "%s: search %s --> %d", name.c_str(), key.c_str(), R);
+                if (present) CHECK(same(value, model[key]), "%s: search %s --> other value", name.c_str(), key.c_str());
+            }
+        }
+    }
+    
+    /* whole contents: lookups, absent keys, random segments, parallel scan */
+    void verify () {
+        valueT value;
+        for (auto &item : model) {
+            CHECK(tree->search(item.first.c_str(), &value) == 0, "%s: lost %s", name.c_str(), item.first.c_str());
+            CHECK(same(value, item.second), "%s: other value of %s", name.c_str(), item.first.c_str());
+        }
+        for (sizeT k = 0; k < keys; ++k) {
+            std::string key = makeKey(k);
+            if (!model.count(key)) CHECK(tree->search(key.c_str(), &value) != 0, "%s: ghost %s", name.c_str(), key.c_str());
+        }
+        
+        /* overlong key is rejected (it isn't cut to other key) */
+        std::string overlong(KEY_SIZE + 6, 'x');
+        CHECK(tree->insert(overlong.c_str(), value) == -1 && tree->search(overlong.c_str(), &value) == -1, "%s: overlong key", name.c_str());
+        
+        for (int i = 0; i < 20; ++i) {
+            std::string a = makeKey(rng() % keys), b = makeKey(rng() % keys);
+            if (keyLess()(b, a)) std::swap(a, b);
+            segment(a, b);
+        }
+        segment(FIRST_KEY, LAST_KEY);
+        
+        std::vector<valueT> values;
+        int k = tree->searchSegmentParallel(FIRST_KEY.c_str(), LAST_KEY.c_str(), values, 4);
+        CHECK(k == int(model.size()), "%s: parallel scan --> %d of %zu", name.c_str(), k, model.size());
+        
+        sizeT i = 0;
+        for (auto &item : model) CHECK(same(values[i++], item.second), "%s: parallel scan, other value of %s", name.c_str(), item.first.c_str());
+    }
+    
+    /* values of [a, b] in order */
+    void segment (const std::string &a, const std::string &b) {
+        std::vector<valueT> values(model.size() + 1);
+        keyT left(a.c_str());
+        int k = tree->searchSegment(&left, b.c_str(), values.data(), values.size());
+        
+        auto from = model.lower_bound(a), to = model.upper_bound(b);
+        CHECK(k == int(std::distance(from, to)), "%s: segment [%s, %s] --> %d", name.c_str(), a.c_str(), b.c_str(), k);
+        
+        for (sizeT i = 0; from != to; ++from, ++i) CHECK(same(values[i], from->second), "%s: segment, other value of %s", name.c_str(), from->first.c_str());
+    }
+    
+    /* removing all keys (merges down to one leaf), then some keys again */
+    void drain () {
+        for (auto &item : model) CHECK(tree->remove(item.first.c_str()) == 0, "%s: drain %s", name.c_str(), item.first.c_str());
+        model.clear();
+        
+        CHECK(tree->getInfo().countLeaf == 1, "%s: %zu leafs after drain", name.c_str(), tree->getInfo().countLeaf);
+        verify();
+        
+        for (sizeT i = 0; i < keys / 4; ++i) step();
+        verify();
+    }
+};
+
+/* PART: modes */
+static std::unique_ptr<BPlusTree> openTree (const configT &config, bool force) {
+    const std::string &mode = config.mode;
+    bool filter = mode == "filter" || mode == "combined";
+    
+    std::unique_ptr<BPlusTree> tree(new BPlusTree(config.path.c_str(), force, filter));
+    if (mode == "cache" || mode == "combined") tree->enableCache(64);
+    if (mode == "pages" || mode == "combined") {
+        tree->enablePageCache(256 * 1024);
+        if (!force) tree->warmUp(true);
+    }
+    if (force && (mode == "compress" || mode == "combined")) tree->enableCompression();
+    return tree;
+}
+
+/* "ops" operations by "rounds", every round is verified */
+static void run (Checker &checker, const configT &config, sizeT rounds) {
+    for (sizeT r = 0; r < rounds; ++r) {
+        for (sizeT i = 0; i < config.ops / rounds; ++i) checker.step();
+        checker.verify();
+    }
+}
+
+static void testTree (const configT &config) {
+    std::unique_ptr<BPlusTree> tree;
+    if (config.mode == "memory") tree.reset(new BPlusTree());
+    else tree = openTree(config, true);
+    
+    Checker checker(config.mode, tree.get(), config.seed, config.keys);
+    run(checker, config, 4);
+    
+    /* round-trip through the file */
+    if (config.mode == "memory") CHECK(tree->persist(config.path.c_str()) == 0, "persist");
+    tree.reset();
+    tree = openTree(config, false);
+    checker.attach(tree.get());
+    checker.verify();
+    
+    run(checker, config, 2);
+    checker.drain();
+    
+    tree.reset();
+    tree = openTree(config, false);
+    checker.attach(tree.get());
+    checker.verify();
+}
+
+static void testTablespace (const configT &config) {
+    const char *names[] = {"users", "orders", "logs"};
+    std::vector<Checker> checkers;
+    
+    {
+        Tablespace space(config.path.c_str(), true, 256 * 1024);
+        for (sizeT t = 0; t < 3; ++t) {
+            BPlusTree *tree = space.open(names[t]);
+            if (t == 1) tree->enableCompression();
+            checkers.push_back(Checker(names[t], tree, config.seed + unsigned(t), config.keys));
+        }
+        
+        for (sizeT i = 0; i < config.ops; ++i) {
+            checkers[i % 3].step();
+            if (i % 5000 == 0) CHECK(space.commit() == 0, "commit");
+        }
+        for (Checker &checker : checkers) checker.verify();
+        
+        CHECK(space.open(std::string(TREE_NAME_SIZE, 'n').c_str()) == nullptr, "too long name of tree");
+    }
+    
+    /* every tree is found again by its name */
+    Tablespace space(config.path.c_str(), false, 256 * 1024);
+    CHECK(space.countTrees() == 3, "%zu trees after reopening", space.countTrees());
+    CHECK(space.open("absent", false) == nullptr, "absent tree");
+    
+    for (sizeT t = 0; t < 3; ++t) {
+        BPlusTree *tree = space.open(names[t], false);
+        CHECK(tree != nullptr, "tree %s after reopening", names[t]);
+        tree->warmUp(true);
+        
+        checkers[t].attach(tree);
+        checkers[t].verify();
+        run(checkers[t], config, 1);
+    }
+    checkers[0].drain();
+}
+
+static void testSharded (const configT &config) {
+    std::mt19937_64 rng(config.seed);
+    modelT model;
+    std::unique_ptr<ShardedBPlusTree> index(new ShardedBPlusTree(config.path.c_str(), 3, true));
+    
+    for (sizeT round = 0; round < 8; ++round) {
+        /* batch of inserts (unique keys), then batch of removes */
+        std::map<std::string, valueT> batch;
+        for (sizeT i = 0; i < config.ops / 16; ++i) batch[makeKey(rng() % config.keys)] = makeValue(rng);
+        
+        std::vector<ShardedBPlusTree::itemT> items;
+        for (auto &item : batch) items.push_back(ShardedBPlusTree::itemT(item.first.c_str(), item.second));
+        
+        std::vector<int> results;
+        index->insert(items, &results, 4);
+        sizeT i = 0;
+        for (auto &item : batch) {
+            bool present = model.count(item.first) > 0;
+            CHECK(results[i++] == (present ? 1 : 0), "sharded: insert %s", item.first.c_str());
+            if (!present) model[item.first] = item.second;
+        }
+        
+        std::vector<keyT> keys;
+        std::vector<std::string> removed;
+        for (sizeT i = 0; i < config.ops / 32; ++i) {
+            std::string key = makeKey(rng() % config.keys);
+            if (std::find(removed.begin(), removed.end(), key) != removed.end()) continue;
+            removed.push_back(key);
+            keys.push_back(key.c_str());
+        }
+        index->remove(keys, &results, 4);
+        for (sizeT i = 0; i < removed.size(); ++i) {
+            CHECK(results[i] == (model.count(removed[i]) ? 0 : -1), "sharded: remove %s", removed[i].c_str());
+            model.erase(removed[i]);
+        }
+        
+        /* merged scan of all shards */
+        std::vector<valueT> values;
+        std::vector<keyT> found;
+        int k = index->searchSegment(FIRST_KEY.c_str(), LAST_KEY.c_str(), values, &found, 4);
+        CHECK(k == int(model.size()), "sharded: scan --> %d of %zu", k, model.size());
+        
+        i = 0;
+        for (auto &item : model) {
+            CHECK(item.first == found[i].K && same(values[i], item.second), "sharded: scan, other record %s", item.first.c_str());
+            ++i;
+        }
+        
+        /* reopening of the shards */
+        if (round % 4 == 3) index.reset(new ShardedBPlusTree(config.path.c_str(), 3));
+    }
+    
+    valueT value;
+    for (auto &item : model) CHECK(index->search(item.first.c_str(), &value) == 0 && same(value, item.second), "sharded: lost %s", item.first.c_str());
+}
+
+/* files of the test */
+static void cleanUp (const configT &config) {
+    ::remove(config.path.c_str());
+    ::remove((config.path + ".hot").c_str());
+    for (int i = 0; i < 3; ++i) ::remove((config.path + "." + std::to_string(i)).c_str());
+}
+
+/* PART: main */
+int main (int argc, char **argv) {
+    configT config;
+    for (int i = 1; i < argc; ++i) {
+        std::string arg = argv[i];
+        bool more = i + 1 < argc;
+        
+        if (arg == "--ops" && more) config.ops = strtoull(argv[++i], nullptr, 10);
+        else if (arg == "--seed" && more) config.seed = unsigned(strtoul(argv[++i], nullptr, 10));
+        else if (arg == "--path" && more) config.path = argv[++i];
+        else if (arg[0] != '-' && config.mode.empty()) config.mode = arg;
+        else config.mode = "?";
+    }
+    
+    const char *modes[] = {"file", "memory", "compress", "pages", "filter", "cache", "combined", "tablespace", "sharded"};
+    if (std::find(std::begin(modes), std::end(modes), config.mode) == std::end(modes)) {
+        fprintf(stderr, "usage: %s file|memory|compress|pages|filter|cache|combined|tablespace|sharded [--ops N] [--seed S] [--path P]\n", argv[0]);
+        return 2;
+    }
+    if (config.path.empty()) config.path = "test_" + config.mode + ".db";
+    if (config.ops < 32) config.ops = 32;
+    
+    cleanUp(config);
+    if (config.mode == "tablespace") testTablespace(config);
+    else if (config.mode == "sharded") testSharded(config);
+    else testTree(config);
+    cleanUp(config);
+    
+    printf("%s: ok (%zu operations, seed %u)\n", config.mode.c_str(), config.ops, config.seed);
+    return 0;
+}
@@ -0,0 +1,137 @@
+#ifndef LookupCache_hpp
+#define LookupCache_hpp
+
+#include <stdint.h>
+#include <string>
+#include <list>
+#include <algorithm>
+#include <vector>
+#include <unordered_map>
+#include <functional>
+
+namespace BPT {
+
+// bounded cache of hot lookups (key --> value) with LRU eviction and TinyLFU admission
+// MARK: new key replaces the LRU victim only if the key is asked more often than the victim
+template <class V>
+class LookupCache {
+public:
+    struct statsT {
+        size_t hits, misses;
+        size_t admitted, rejected; // admission of missed keys
+    };
+
+private:
+    typedef std::pair<std::string, V> itemT;
+    
+    std::list<itemT> items; // front --> the most recently used
+    std::unordered_map<std::string, typename std::list<itemT>::iterator> places;
+    size_t capacity;
+    
+    // frequency sketch (count-min, 4 rows in one array of saturating counters)
+    std::vector<uint8_t> sketch;
+    size_t samples; // accesses since the last aging
+    
+    statsT stats;
+    
+    static uint64_t mix (uint64_t h) {
+        h += 0x9e3779b97f4a7c15ULL;
+        h = (h ^ (h >> 30)) * 0xbf58476d1ce4e5b9ULL;
+        h = (h ^ (h >> 27)) * 0x94d049bb133111ebULL;
+        return h ^ (h >> 31);
+    }
+    
+    /* row-th counter of the key (double hashing, width of sketch is a power of 2) */
+    size_t position (uint64_t h, size_t row) const {
+        return size_t((h + row * ((h >> 32) | 1)) & (sketch.size() - 1));
+    }
+    
+    /* counting the access; counters are halved from time to time, so old popularity fades */
+    void touch (uint64_t h) {
+        for (size_t row = 0; row < 4; ++row) {
+            uint8_t &c = sketch[position(h, row)];
+            if (c != UINT8_MAX) ++c;
+        }
+        
+        if (++samples >= 10 * capacity) {
+            for (uint8_t &c : sketch) c >>= 1;
+            samples /= 2;
+        }
+    }
+    
+    uint8_t frequency (uint64_t h) const {
+        uint8_t f = UINT8_MAX;
+        for (size_t row = 0; row < 4; ++row) f = std::min(f, sketch[position(h, row)]);
+        return f;
+    }
+    
+    static uint64_t hash (const std::string &key) {return mix(std::hash<std::string>()(key));}
+
+public:
+    explicit LookupCache (size_t newCapacity) : capacity(newCapacity ? newCapacity : 1), samples(0), stats() {
+        size_t width = 64;
+        while (width < 4 * capacity) width <<= 1;
+        sketch.assign(width, 0);
+    }
+    
+    size_t size () const {return items.size();}
+    statsT getStats () const {return stats;}
+    void resetStats () {stats = statsT();}
+    
+    bool get (const std::string &key, V *value) {
+        touch(hash(key));
+        
+        auto place = places.find(key);
+        if (place == places.end()) {
+            ++stats.misses;
+            return false;
+        }
+        
+        ++stats.hits;
+        items.splice(items.begin(), items, place->second);
+        *value = place->second->second;
+        return true;
+    }
+    
+    /* value of missed key (it's already counted by get) */
+    void put (const std::string &key, const V &value) {
+        auto place = places.find(key);
+        if (place != places.end()) {
+            place->second->second = value;
+            return;
+        }
+        
+        if (items.size() >= capacity) {
+            /* admission: the candidate must be hotter than the victim */
+            const std::string &victim = items.back().first;
+            if (frequency(hash(key)) <= frequency(hash(victim))) {
+                ++stats.rejected;
+                return;
+            }
+            
+            places.erase(victim);
+            items.pop_back();
+        }
+        
+        ++stats.admitted;
+        items.emplace_front(key, value);
+        places[key] = items.begin();
+    }
+    
+    void erase (const std::string &key) {
+        auto place = places.find(key);
+        if (place == places.end()) return;
+        
+        items.erase(place->second);
+        places.erase(place);
+    }
+    
+    void clear () {
+        items.clear();
+        places.clear();
+    }
+};
+
+}
+
+#endif /* LookupCache_hpp */
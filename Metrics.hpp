@@ -0,0 +1,216 @@
+#ifndef Metrics_hpp
+#define Metrics_hpp
+
+#include <stdint.h>
+#include <stdlib.h>
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <memory>
+#include <mutex>
+#include <new>
+#include <tuple>
+#include <vector>
+#include <unordered_map>
+
+#define METRICS_BUCKETS 40 // bucket i of histogram: latency in [2^i, 2^(i+1)) ns
+
+namespace BPT {
+
+// runtime counters of the tree
+// MARK: every thread writes its own block of counters (no locks, no shared cache lines), snapshot() sums the blocks
+// MARK: the block of ended thread is added to "retired" (short-lived workers don't pile up)
+class Metrics {
+public:
+    enum opT {SEARCH, SEARCH_SEGMENT, INSERT, REMOVE, UPDATE, OPS};
+    enum counterT {
+        PAGE_READS, PAGE_WRITES, // calls of map()/unmap()
+        BYTES_READ, BYTES_WRITTEN,
+        SPLITS, MERGES, BORROWS,
+        COUNTERS
+    };
+    
+    // summed counters
+    struct snapshotT {
+        uint64_t count[OPS];
+        uint64_t nanos[OPS]; // total time
+        uint64_t histogram[OPS][METRICS_BUCKETS];
+        uint64_t counter[COUNTERS];
+        
+        /* latency (ns) below which the "q" share of operations is (upper bound of the bucket) */
+        uint64_t percentile (opT op, double q) const {
+            uint64_t want = uint64_t(q * count[op]), seen = 0;
+            for (size_t i = 0; i < METRICS_BUCKETS; ++i) {
+                seen += histogram[op][i];
+                if (seen > want || seen == count[op]) return uint64_t(2) << i;
+            }
+            return 0;
+        }
+        uint64_t mean (opT op) const {return count[op] ? nanos[op] / count[op] : 0;}
+    };
+
+private:
+    struct alignas(64) localT {
+        std::atomic<uint64_t> count[OPS];
+        std::atomic<uint64_t> nanos[OPS];
+        std::atomic<uint64_t> histogram[OPS][METRICS_BUCKETS];
+        std::atomic<uint64_t> counter[COUNTERS];
+        
+        localT () {reset();}
+        
+        void reset () {
+            for (size_t op = 0; op < OPS; ++op) {
+                count[op].store(0, std::memory_order_relaxed);
+                nanos[op].store(0, std::memory_order_relaxed);
+                for (size_t i = 0; i < METRICS_BUCKETS; ++i) histogram[op][i].store(0, std::memory_order_relaxed);
+            }
+            for (size_t c = 0; c < COUNTERS; ++c) counter[c].store(0, std::memory_order_relaxed);
+        }
+        
+        /* adding "other" (the caller holds the lock of blocks) */
+        void add (const localT &other) {
+            for (size_t op = 0; op < OPS; ++op) {
+                bump(count[op], other.count[op].load(std::memory_order_relaxed));
+                bump(nanos[op], other.nanos[op].load(std::memory_order_relaxed));
+                for (size_t i = 0; i < METRICS_BUCKETS; ++i) bump(histogram[op][i], other.histogram[op][i].load(std::memory_order_relaxed));
+            }
+            for (size_t c = 0; c < COUNTERS; ++c) bump(counter[c], other.counter[c].load(std::memory_order_relaxed));
+        }
+    };
+    
+    /* over-aligned objects (C++14 "new" doesn't keep the alignment of 64) */
+    template <class T> static T *alignedNew () {
+        void *memory = nullptr;
+        if (posix_memalign(&memory, alignof(T), sizeof(T)) != 0) throw std::bad_alloc();
+        return new (memory) T();
+    }
+    template <class T> struct alignedDelete {
+        void operator () (T *object) const {
+            object->~T();
+            free(object);
+        }
+    };
+    
+    // blocks of the living threads + sum of the ended ones (it can outlive the metrics, see ownerT)
+    struct sharedT {
+        std::mutex lock;
+        std::vector<localT *> locals;
+        localT retired;
+    };
+    
+    // block of one thread for one metrics: it's retired when the thread ends
+    struct ownerT {
+        std::weak_ptr<sharedT> shared;
+        std::unique_ptr<localT, alignedDelete<localT>> block;
+        
+        ~ownerT () {
+            std::shared_ptr<sharedT> s = shared.lock();
+            if (!s || !block) return;
+            
+            std::lock_guard<std::mutex> guard(s->lock);
+            s->retired.add(*block);
+            s->locals.erase(std::find(s->locals.begin(), s->locals.end(), block.get()));
+        }
+    };
+    
+    /* only the owner thread writes the counter, so load + store is enough (no locked add) */
+    static void bump (std::atomic<uint64_t> &c, uint64_t delta) {
+        c.store(c.load(std::memory_order_relaxed) + delta, std::memory_order_relaxed);
+    }
+    
+    uint64_t id; // number of the metrics (threads find their blocks by it)
+    std::shared_ptr<sharedT> shared;
+    
+    static uint64_t newId () {
+        static std::atomic<uint64_t> last(0);
+        return ++last;
+    }
+    
+    /* block of the current thread (it's registered at the first use) */
+    localT &local () {
+        thread_local uint64_t lastId = 0;
+        thread_local localT *last = nullptr;
+        if (lastId == id) return *last;
+        
+        thread_local std::unordered_map<uint64_t, ownerT> blocks;
+        auto found = blocks.find(id);
+        
+        if (found == blocks.end()) {
+            /* blocks of the destroyed metrics are dropped */
+            for (auto b = blocks.begin(); b != blocks.end(); )
+                b = b->second.shared.expired() ? blocks.erase(b) : std::next(b);
+            
+            found = blocks.emplace(std::piecewise_construct, std::forward_as_tuple(id), std::forward_as_tuple()).first;
+            found->second.shared = shared;
+            found->second.block.reset(alignedNew<localT>());
+            
+            std::lock_guard<std::mutex> guard(shared->lock);
+            shared->locals.push_back(found->second.block.get());
+        }
+        
+        lastId = id;
+        last = found->second.block.get();
+        return *last;
+    }
+
+public:
+    Metrics () : id(newId()), shared(alignedNew<sharedT>(), alignedDelete<sharedT>()) {}
+    
+    Metrics (const Metrics &) = delete;
+    Metrics &operator = (const Metrics &) = delete;
+    
+    void add (counterT c, uint64_t delta = 1) {bump(local().counter[c], delta);}
+    
+    void record (opT op, uint64_t nanos) {
+        size_t bucket = 0;
+        while (bucket + 1 < METRICS_BUCKETS && (nanos >> (bucket + 1)) != 0) ++bucket;
+        
+        localT &l = local();
+        bump(l.count[op], 1);
+        bump(l.nanos[op], nanos);
+        bump(l.histogram[op][bucket], 1);
+    }
+    
+    snapshotT snapshot () {
+        snapshotT s = snapshotT();
+        
+        std::lock_guard<std::mutex> guard(shared->lock);
+        std::vector<localT *> blocks(shared->locals);
+        blocks.push_back(&shared->retired);
+        
+        for (localT *l : blocks) {
+            for (size_t op = 0; op < OPS; ++op) {
+                s.count[op] += l->count[op].load(std::memory_order_relaxed);
+                s.nanos[op] += l->nanos[op].load(std::memory_order_relaxed);
+                for (size_t i = 0; i < METRICS_BUCKETS; ++i) s.histogram[op][i] += l->histogram[op][i].load(std::memory_order_relaxed);
+            }
+            for (size_t c = 0; c < COUNTERS; ++c) s.counter[c] += l->counter[c].load(std::memory_order_relaxed);
+        }
+        return s;
+    }
+    
+    /* MARK: increments of other threads at the same moment can survive the reset */
+    void reset () {
+        std::lock_guard<std::mutex> guard(shared->lock);
+        for (localT *l : shared->locals) l->reset();
+        shared->retired.reset();
+    }
+    
+    // measuring of one operation (from constructor to destructor)
+    class timerT {
+        Metrics &metrics;
+        opT op;
+        std::chrono::steady_clock::time_point start;
+    
+    public:
+        timerT (Metrics &m, opT o) : metrics(m), op(o), start(std::chrono::steady_clock::now()) {}
+        ~timerT () {
+            auto spent = std::chrono::steady_clock::now() - start;
+            metrics.record(op, uint64_t(std::chrono::duration_cast<std::chrono::nanoseconds>(spent).count()));
+        }
+    };
+};
+
+}
+
+#endif /* Metrics_hpp */
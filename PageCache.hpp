@@ -0,0 +1,185 @@
+#ifndef PageCache_hpp
+#define PageCache_hpp
+
+#include <stdint.h>
+#include <string.h>
+#include <sys/types.h>
+#include <list>
+#include <map>
+#include <mutex>
+#include <vector>
+
+namespace BPT {
+
+// cache of whole blocks of the file (nodes, leaf pages) with LRU eviction
+// MARK: it's write-through -- every write of the file is copied in the cached block too
+// MARK: pinned blocks are never evicted
+class PageCache {
+public:
+    struct statsT {
+        size_t hits, misses;
+        size_t bytes, pages; // cached now
+    };
+    
+    // cached block (for saving of the hot list)
+    struct pageT {
+        off_t offset;
+        size_t size;
+    };
+
+private:
+    struct entryT {
+        std::vector<char> data;
+        std::list<off_t>::iterator place; // in "lru" (if not pinned)
+        bool pinned;
+    };
+    typedef std::map<off_t, entryT>::iterator iteratorT;
+    
+    mutable std::mutex lock;
+    std::map<off_t, entryT> entries;
+    std::list<off_t> lru; // front --> the most recently used
+    size_t capacity, bytes;
+    
+    // count of writes (the prefetched block which was read before a write can be stale)
+    uint64_t version;
+    bool dirty; // writes aren't flushed in the file yet
+    
+    statsT stats;
+    
+    /* cached block which contains [offset:offset + size) */
+    iteratorT find (off_t offset, size_t size) {
+        iteratorT e = entries.upper_bound(offset);
+        if (e == entries.begin()) return entries.end();
+        --e;
+        
+        if (offset + off_t(size) > e->first + off_t(e->second.data.size())) return entries.end();
+        return e;
+    }
+    
+    void touch (entryT &e) {
+        if (!e.pinned) lru.splice(lru.begin(), lru, e.place);
+    }
+    
+    void evict () {
+        while (bytes > capacity && !lru.empty()) {
+            iteratorT e = entries.find(lru.back());
+            bytes -= e->second.data.size();
+            entries.erase(e);
+            lru.pop_back();
+        }
+    }
+    
+    void put (off_t offset, const void *block, size_t size, bool pin) {
+        iteratorT e = entries.find(offset);
+        if (e == entries.end()) {
+            e = entries.emplace(offset, entryT()).first;
+            e->second.pinned = pin;
+            if (!pin) {
+                lru.push_front(offset);
+                e->second.place = lru.begin();
+            }
+            bytes += size;
+        } else {
+            bytes += size;
+            bytes -= e->second.data.size();
+            touch(e->second);
+            
+            if (pin && !e->second.pinned) {
+                lru.erase(e->second.place);
+                e->second.pinned = true;
+            }
+        }
+        
+        e->second.data.assign((const char *)block, (const char *)block + size);
+        evict();
+    }
+
+public:
+    explicit PageCache (size_t newCapacity) : capacity(newCapacity), bytes(0), version(0), dirty(false), stats() {}
+    
+    PageCache (const PageCache &) = delete;
+    PageCache &operator = (const PageCache &) = delete;
+    
+    bool read (void *block, off_t offset, size_t size) {
+        std::lock_guard<std::mutex> guard(lock);
+        
+        iteratorT e = find(offset, size);
+        if (e == entries.end()) {
+            ++stats.misses;
+            return false;
+        }
+        
+        ++stats.hits;
+        touch(e->second);
+        memcpy(block, e->second.data.data() + (offset - e->first), size);
+        return true;
+    }
+    
+    /* block read from the file */
+    void insert (off_t offset, const void *block, size_t size, bool pin = false) {
+        std::lock_guard<std::mutex> guard(lock);
+        put(offset, block, size, pin);
+    }
+    
+    /* block read in the background: it's dropped if the file was written since "since" (see getVersion) */
+    /* or if writes aren't flushed yet (the file can keep the old bytes till flushed()) */
+    bool prefetched (off_t offset, const void *block, size_t size, uint64_t since) {
+        std::lock_guard<std::mutex> guard(lock);
+        if (dirty || since != version || entries.count(offset)) return false;
+        
+        put(offset, block, size, false);
+        return true;
+    }
+    
+    uint64_t getVersion () const {
+        std::lock_guard<std::mutex> guard(lock);
+        return version;
+    }
+    
+    /* write of the file: the cached block is changed too */
+    void write (const void *block, off_t offset, size_t size) {
+        std::lock_guard<std::mutex> guard(lock);
+        ++version;
+        dirty = true;
+        
+        iteratorT e = find(offset, size);
+        if (e != entries.end()) memcpy(e->second.data.data() + (offset - e->first), block, size);
+    }
+    
+    /* the writes reached the file (blocks read from the file after it are fresh) */
+    void flushed () {
+        std::lock_guard<std::mutex> guard(lock);
+        if (dirty) ++version;
+        dirty = false;
+    }
+    
+    /* pinned blocks first, then the most recently used ones */
+    std::vector<pageT> hot () const {
+        std::lock_guard<std::mutex> guard(lock);
+        
+        std::vector<pageT> pages;
+        for (auto &e : entries)
+            if (e.second.pinned) pages.push_back(pageT{e.first, e.second.data.size()});
+        for (off_t offset : lru)
+            pages.push_back(pageT{offset, entries.find(offset)->second.data.size()});
+        return pages;
+    }
+    
+    statsT getStats () const {
+        std::lock_guard<std::mutex> guard(lock);
+        
+        statsT s = stats;
+        s.bytes = bytes;
+        s.pages = entries.size();
+        return s;
+    }
+    
+    void resetStats () {
+        std::lock_guard<std::mutex> guard(lock);
+        stats.hits = stats.misses = 0;
+    }
+};
+
+}
+
+#endif /* PageCache_hpp */
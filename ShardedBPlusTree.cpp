@@ -0,0 +1,194 @@
+#include "ShardedBPlusTree.hpp"
+#include "ThreadPool.hpp"
+#include <queue>
+
+
+// IMPLEMENTATION OF SHARDED B-PLUS-TREE
+
+namespace BPT {
+
+/* PART: constructors */
+/* opening "basePath.0", "basePath.1", ... */
+void  ShardedBPlusTree::openShards (const char *basePath, sizeT count, bool force) {
+    assert(count > 0);
+    
+    for (sizeT i = 0; i < count; ++i) {
+        std::string path = std::string(basePath) + "." + std::to_string(i);
+        shards.emplace_back(new BPlusTree(path.c_str(), force));
+        locks.emplace_back(new std::mutex);
+    }
+}
+
+ShardedBPlusTree::ShardedBPlusTree (const char *basePath, sizeT count, bool force) : mode(HASH) {
+    openShards(basePath, count, force);
+}
+
+ShardedBPlusTree::ShardedBPlusTree (const char *basePath, const std::vector<keyT> &newBounds, bool force)
+    : mode(RANGE), bounds(newBounds) {
+    for (sizeT i = 1; i < bounds.size(); ++i)
+        assert(keycmp(bounds[i - 1], bounds[i]) < 0);
+    
+    openShards(basePath, bounds.size() + 1, force);
+}
+
+/* PART: routing */
+sizeT  ShardedBPlusTree::shardOf (const keyT &key) const {
+    if (mode == HASH) return keyHash(key) % shards.size();
+    
+    /* first bound > key */
+    return std::upper_bound(bounds.begin(), bounds.end(), key, [] (const keyT &l, const keyT &r) {
+        return keycmp(l, r) < 0;
+    }) - bounds.begin();
+}
+
+int  ShardedBPlusTree::search (const keyT &key, valueT *value) const {
+    sizeT i = shardOf(key);
+    std::lock_guard<std::mutex> guard(*locks[i]);
+    return shards[i]->search(key, value);
+}
+
+int  ShardedBPlusTree::insert (const keyT &key, valueT value) {
+    sizeT i = shardOf(key);
+    std::lock_guard<std::mutex> guard(*locks[i]);
+    return shards[i]->insert(key, value);
+}
+
+int  ShardedBPlusTree::remove (const keyT &key) {
+    sizeT i = shardOf(key);
+    std::lock_guard<std::mutex> guard(*locks[i]);
+    return shards[i]->remove(key);
+}
+
+int  ShardedBPlusTree::update (const keyT &key, valueT value) {
+    sizeT i = shardOf(key);
+    std::lock_guard<std::mutex> guard(*locks[i]);
+    return shards[i]->update(key, value);
+}
+
+int  ShardedBPlusTree::update (const keyT &key, const std::function<void (valueT &)> &change) {
+    sizeT i = shardOf(key);
+    std::lock_guard<std::mutex> guard(*locks[i]);
+    return shards[i]->update(key, change);
+}
+
+/* PART: batches */
+/* items are grouped by shards, every group is written by one worker (in the order of items) */
+int  ShardedBPlusTree::insert (const std::vector<itemT> &items, std::vector<int> *results, sizeT threads) {
+    std::vector<std::vector<sizeT>> groups(shards.size());
+    for (sizeT k = 0; k < items.size(); ++k)
+        groups[shardOf(items[k].first)].push_back(k);
+    
+    std::vector<int> res(items.size(), 0);
+    {
+        ThreadPool pool(threads ? threads : std::min<sizeT>(shards.size(), std::thread::hardware_concurrency()));
+        for (sizeT i = 0; i < shards.size(); ++i) {
+            if (groups[i].empty()) continue;
+            
+            pool.submit([this, i, &groups, &items, &res] {
+                std::lock_guard<std::mutex> guard(*locks[i]);
+                for (sizeT k : groups[i]) res[k] = shards[i]->insert(items[k].first, items[k].second);
+            });
+        }
+        pool.wait();
+    }
+    
+    int done = int(std::count(res.begin(), res.end(), 0));
+    if (results != nullptr) results->swap(res);
+    return done;
+}
+
+int  ShardedBPlusTree::remove (const std::vector<keyT> &keys, std::vector<int> *results, sizeT threads) {
+    std::vector<std::vector<sizeT>> groups(shards.size());
+    for (sizeT k = 0; k < keys.size(); ++k)
+        groups[shardOf(keys[k])].push_back(k);
+    
+    std::vector<int> res(keys.size(), 0);
+    {
+        ThreadPool pool(threads ? threads : std::min<sizeT>(shards.size(), std::thread::hardware_concurrency()));
+        for (sizeT i = 0; i < shards.size(); ++i) {
+            if (groups[i].empty()) continue;
+            
+            pool.submit([this, i, &groups, &keys, &res] {
+                std::lock_guard<std::mutex> guard(*locks[i]);
+                for (sizeT k : groups[i]) res[k] = shards[i]->remove(keys[k]);
+            });
+        }
+        pool.wait();
+    }
+    
+    int done = int(std::count(res.begin(), res.end(), 0));
+    if (results != nullptr) results->swap(res);
+    return done;
+}
+
+/* PART: scanning */
+void  ShardedBPlusTree::scanShards (const keyT &a, const keyT &b, std::vector<std::vector<recordT>> &parts, sizeT threads) const {
+    parts.assign(shards.size(), std::vector<recordT>());
+    
+    /* RANGE: only shards crossing [a, b] */
+    sizeT first = 0, last = shards.size();
+    if (mode == RANGE) {
+        first = shardOf(a);
+        last = shardOf(b) + 1;
+    }
+    
+    ThreadPool pool(threads ? threads : std::min<sizeT>(last - first, std::thread::hardware_concurrency()));
+    for (sizeT i = first; i < last; ++i) {
+        pool.submit([this, i, &a, &b, &parts] {
+            std::lock_guard<std::mutex> guard(*locks[i]);
+            shards[i]->scanParallel(a, b, [&parts, i] (sizeT, const recordT *from, const recordT *to) {
+                parts[i].insert(parts[i].end(), from, to);
+            }, 1);
+        });
+    }
+    pool.wait();
+}
+
+int  ShardedBPlusTree::searchSegment (const keyT &a, const keyT &b, std::vector<valueT> &values,
+                                      std::vector<keyT> *keys, sizeT threads) const {
+    values.clear();
+    if (keys != nullptr) keys->clear();
+    if (a.overlong() || b.overlong() || keycmp(a, b) > 0) return -1;
+    
+    std::vector<std::vector<recordT>> parts;
+    scanShards(a, b, parts, threads);
+    
+    sizeT total = 0;
+    for (std::vector<recordT> &part : parts) total += part.size();
+    values.reserve(total);
+    if (keys != nullptr) keys->reserve(total);
+    
+    if (mode == RANGE) {
+        /* shards are already in order */
+        for (std::vector<recordT> &part : parts)
+            for (recordT &record : part) {
+                values.push_back(record.value);
+                if (keys != nullptr) keys->push_back(record.key);
+            }
+        return int(total);
+    }
+    
+    /* HASH: k-way merge of the shards */
+    typedef std::pair<sizeT, sizeT> headT; // (shard, position)
+    auto greater = [&parts] (const headT &l, const headT &r) {
+        return keycmp(parts[l.first][l.second].key, parts[r.first][r.second].key) > 0;
+    };
+    std::priority_queue<headT, std::vector<headT>, decltype(greater)> heads(greater);
+    
+    for (sizeT i = 0; i < parts.size(); ++i)
+        if (!parts[i].empty()) heads.push(headT(i, 0));
+    
+    while (!heads.empty()) {
+        headT head = heads.top(); heads.pop();
+        recordT &record = parts[head.first][head.second];
+        
+        values.push_back(record.value);
+        if (keys != nullptr) keys->push_back(record.key);
+        
+        if (++head.second < parts[head.first].size()) heads.push(head);
+    }
+    
+    return int(total);
+}
+
+}
@@ -0,0 +1,63 @@
+#ifndef ShardedBPlusTree_hpp
+#define ShardedBPlusTree_hpp
+
+#include "BPlusTree.hpp"
+#include <memory>
+#include <mutex>
+
+namespace BPT {
+
+// index over several b+ trees (one file and one writer per shard)
+// MARK: the shards' config isn't saved -- open the index with the same config every time
+class ShardedBPlusTree {
+public:
+    enum modeT {
+        RANGE, // shard i keeps keys of [bounds[i-1], bounds[i])
+        HASH   // shard is chosen by the hash of key
+    };
+    
+    typedef std::pair<keyT, valueT> itemT;
+
+private:
+    modeT mode;
+    std::vector<keyT> bounds;
+    
+    std::vector<std::unique_ptr<BPlusTree>> shards;
+    // one writer per shard (the tree itself isn't thread-safe)
+    mutable std::vector<std::unique_ptr<std::mutex>> locks;
+    
+    void openShards (const char *basePath, sizeT count, bool force);
+    
+    // scanning [a, b] of every shard on the pool
+    void scanShards (const keyT &a, const keyT &b, std::vector<std::vector<recordT>> &parts, sizeT threads) const;
+
+public:
+    // HASH index of "count" shards
+    ShardedBPlusTree (const char *basePath, sizeT count, bool force = false);
+    // RANGE index of "bounds.size() + 1" shards (bounds are ascending)
+    ShardedBPlusTree (const char *basePath, const std::vector<keyT> &bounds, bool force = false);
+    
+    sizeT shardOf (const keyT &key) const;
+    sizeT countShards () const {return shards.size();}
+    BPlusTree &shard (sizeT i) {return *shards[i];}
+    
+    // basic methods (as in BPlusTree), routed to the shard of key
+    int search (const keyT &key, valueT *value) const;
+    int insert (const keyT &key, valueT value);
+    int remove (const keyT &key);
+    int update (const keyT &key, valueT value);
+    int update (const keyT &key, const std::function<void (valueT &)> &change);
+    
+    // batch methods: shards are written in parallel ("threads" == 0 --> one worker per core)
+    // return count of succeeded items, "results" (if not null) gets result of every item
+    int insert (const std::vector<itemT> &items, std::vector<int> *results = nullptr, sizeT threads = 0);
+    int remove (const std::vector<keyT> &keys, std::vector<int> *results = nullptr, sizeT threads = 0);
+    
+    // values of key[a:b] of all shards merged in order (and keys, if not null)
+    int searchSegment (const keyT &a, const keyT &b, std::vector<valueT> &values,
+                       std::vector<keyT> *keys = nullptr, sizeT threads = 0) const;
+};
+
+}
+
+#endif /* ShardedBPlusTree_hpp */
@@ -0,0 +1,107 @@
+#include "Tablespace.hpp"
+
+
+// IMPLEMENTATION OF TABLESPACE
+
+namespace BPT {
+
+static_assert(sizeof(catalogT) <= CATALOG_SIZE, "catalog is one page");
+
+/* PART: constructor */
+Tablespace::Tablespace (const char *newPath, bool force, sizeT cacheBytes) : F(nullptr) {
+    bzero(filePath, sizeof(filePath));
+    strcpy(filePath, newPath);
+    bzero(&catalog, sizeof(catalog));
+    
+    if (!force) F = fopen(filePath, "rb+");
+    
+    /* reading catalog (no file or other file --> new tablespace) */
+    if (F != nullptr) {
+        fseek(F, 0, SEEK_SET);
+        if (fread(&catalog, sizeof(catalog), 1, F) != 1 || catalog.magic != SPACE_MAGIC) {
+            fclose(F);
+            F = nullptr;
+        }
+    }
+    
+    if (F == nullptr) {
+        F = fopen(filePath, "w+");
+        assert(F != nullptr);
+        
+        bzero(&catalog, sizeof(catalog));
+        catalog.magic = SPACE_MAGIC;
+        catalog.slot = CATALOG_SIZE;
+        unmapCatalog();
+    }
+    
+    if (cacheBytes) pages.reset(new PageCache(cacheBytes));
+}
+
+Tablespace::~Tablespace () {
+    /* trees first (they use the file) */
+    trees.clear();
+    commit();
+    fclose(F);
+}
+
+/* PART: catalog */
+int  Tablespace::unmapCatalog (bool header) {
+    sizeT size = header ? sizeof(catalog.magic) + sizeof(catalog.slot) + sizeof(catalog.count) : sizeof(catalog);
+    
+    fseek(F, 0, SEEK_SET);
+    return int(fwrite(&catalog, size, 1, F)) - 1;
+}
+
+/* the slot is saved at every allocation, so blocks are never given twice (even after a crash) */
+offT  Tablespace::alloc (sizeT size) {
+    offT slot = catalog.slot;
+    catalog.slot += size;
+    unmapCatalog(true);
+    return slot;
+}
+
+BPlusTree  *Tablespace::open (const char *name, bool create) {
+    /* longer name would be cut in the catalog (and never found again) */
+    if (strlen(name) >= TREE_NAME_SIZE) return nullptr;
+    
+    auto opened = trees.find(name);
+    if (opened != trees.end()) return opened->second.get();
+    
+    /* searching the catalog */
+    for (sizeT i = 0; i < catalog.count; ++i)
+        if (strcmp(catalog.tree[i].name, name) == 0) {
+            BPlusTree *tree = new BPlusTree(this, catalog.tree[i].meta, false);
+            trees[name].reset(tree);
+            return tree;
+        }
+    
+    const sizeT capacity = sizeof(catalog.tree) / sizeof(catalog.tree[0]);
+    if (!create || catalog.count == capacity) return nullptr;
+    
+    /* new tree: place of its meta + entry of the catalog */
+    catalogT::entryT &entry = catalog.tree[catalog.count];
+    bzero(entry.name, sizeof(entry.name));
+    memcpy(entry.name, name, strlen(name));
+    entry.meta = alloc(sizeof(metaT));
+    ++catalog.count;
+    
+    BPlusTree *tree = new BPlusTree(this, entry.meta, true);
+    unmapCatalog();
+    
+    trees[name].reset(tree);
+    return tree;
+}
+
+std::vector<std::string>  Tablespace::names () const {
+    std::vector<std::string> result;
+    for (sizeT i = 0; i < catalog.count; ++i) result.push_back(catalog.tree[i].name);
+    return result;
+}
+
+/* PART: group commit */
+int  Tablespace::commit () {
+    if (fflush(F) != 0) return -1;
+    return fsync(fileno(F));
+}
+
+}
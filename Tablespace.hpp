@@ -0,0 +1,72 @@
+#ifndef Tablespace_hpp
+#define Tablespace_hpp
+
+#include "BPlusTree.hpp"
+#include <map>
+
+namespace BPT {
+
+#define CATALOG_SIZE 4096 // catalog page at the start of the tablespace
+#define TREE_NAME_SIZE 48 // name of tree is shorter than TREE_NAME_SIZE
+#define SPACE_MAGIC 0x4250545350414345ULL // "BPTSPACE"
+
+// catalog page: trees of the tablespace and its allocator
+struct catalogT {
+    uint64_t magic;
+    offT slot;   // place of storing new block (shared by all trees)
+    sizeT count; // count of trees
+    
+    struct entryT {
+        char name[TREE_NAME_SIZE];
+        offT meta; // place of metaT of the tree
+    } tree[(CATALOG_SIZE - sizeof(uint64_t) - sizeof(offT) - sizeof(sizeT)) / (TREE_NAME_SIZE + sizeof(offT))];
+};
+
+// many named b+ trees in one file: one catalog, one allocator, one file handle and one page cache
+// MARK: the trees write through the shared file as usual, commit() makes the writes of all trees durable at once
+class Tablespace {
+private:
+    char filePath [512];
+    FILE *F;
+    catalogT catalog;
+    
+    // shared page cache (null --> off), eviction is global for all trees
+    std::shared_ptr<PageCache> pages;
+    
+    std::map<std::string, std::unique_ptr<BPlusTree>> trees;
+    
+    // writing the catalog (header only: magic, slot, count --> "header")
+    int unmapCatalog (bool header = false);
+    
+    friend class BPlusTree;
+    
+    // shared allocator (for the trees)
+    offT alloc (sizeT size);
+    FILE *file () const {return F;}
+    const char *path () const {return filePath;}
+    std::shared_ptr<PageCache> pool () const {return pages;}
+
+public:
+    // "cacheBytes" --> size of the shared page cache (0 --> no cache)
+    Tablespace (const char *filePath, bool force = false, sizeT cacheBytes = 0);
+    ~Tablespace ();
+    
+    Tablespace (const Tablespace &) = delete;
+    Tablespace &operator = (const Tablespace &) = delete;
+    
+    // tree of "name" (it's created if "create"), null --> no such tree (or no place in the catalog, or too long name)
+    // MARK: the tree belongs to the tablespace, it lives while the tablespace is opened
+    BPlusTree *open (const char *name, bool create = true);
+    
+    std::vector<std::string> names () const;
+    sizeT countTrees () const {return catalog.count;}
+    
+    // group commit: the writes of all trees reach the disk with one sync
+    int commit ();
+    
+    PageCache::statsT cacheStats () const {return pages ? pages->getStats() : PageCache::statsT();}
+};
+
+}
+
+#endif /* Tablespace_hpp */
@@ -0,0 +1,130 @@
+#ifndef ThreadPool_hpp
+#define ThreadPool_hpp
+
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <functional>
+#include <memory>
+#include <deque>
+#include <vector>
+
+namespace BPT {
+
+// pool of workers with a queue per worker
+// MARK: idle worker steals tasks from the others' queues, so skewed tasks don't stall the pool
+class ThreadPool {
+public:
+    typedef std::function<void ()> taskT;
+
+private:
+    struct queueT {
+        std::mutex lock;
+        std::deque<taskT> tasks;
+    };
+    
+    std::vector<std::thread> workers;
+    std::vector<std::unique_ptr<queueT>> queues;
+    
+    std::mutex lock;
+    std::condition_variable wake, idle;
+    size_t queued;  // tasks waiting in the queues
+    size_t pending; // tasks submitted but not finished
+    size_t nextQueue;
+    bool stop;
+    
+    /* own queue is taken from the front, others' queues -- from the back */
+    bool pop (size_t id, taskT &task) {
+        for (size_t i = 0; i < queues.size(); ++i) {
+            queueT &q = *queues[(id + i) % queues.size()];
+            std::lock_guard<std::mutex> guard(q.lock);
+            if (q.tasks.empty()) continue;
+            
+            if (i == 0) { task = std::move(q.tasks.front()); q.tasks.pop_front(); }
+            else { task = std::move(q.tasks.back()); q.tasks.pop_back(); }
+            
+            std::lock_guard<std::mutex> g(lock);
+            --queued;
+            return true;
+        }
+        return false;
+    }
+    
+    void run (size_t id) {
+        for (;;) {
+            taskT task;
+            if (pop(id, task)) {
+                task();
+                
+                std::lock_guard<std::mutex> guard(lock);
+                if (--pending == 0) idle.notify_all();
+                continue;
+            }
+            
+            std::unique_lock<std::mutex> guard(lock);
+            wake.wait(guard, [this] { return stop || queued > 0; });
+            if (stop && queued == 0) return;
+        }
+    }
+
+public:
+    /* "threads" == 0 --> one worker per core */
+    explicit ThreadPool (size_t threads = 0) : queued(0), pending(0), nextQueue(0), stop(false) {
+        if (threads == 0) threads = std::thread::hardware_concurrency();
+        if (threads == 0) threads = 1;
+        
+        for (size_t i = 0; i < threads; ++i) queues.emplace_back(new queueT);
+        for (size_t i = 0; i < threads; ++i) workers.emplace_back(&ThreadPool::run, this, i);
+    }
+    
+    ~ThreadPool () {
+        {
+            std::lock_guard<std::mutex> guard(lock);
+            stop = true;
+        }
+        wake.notify_all();
+        for (std::thread &w : workers) w.join();
+    }
+    
+    ThreadPool (const ThreadPool &) = delete;
+    ThreadPool &operator = (const ThreadPool &) = delete;
+    
+    size_t size () const {return workers.size();}
+    
+    /* task to the queue of "worker" */
+    void submit (size_t worker, taskT task) {
+        queueT &q = *queues[worker % queues.size()];
+        {
+            std::lock_guard<std::mutex> guard(lock);
+            ++pending;
+        }
+        {
+            /* same locking order as in pop() */
+            std::lock_guard<std::mutex> guard(q.lock);
+            q.tasks.push_back(std::move(task));
+            
+            std::lock_guard<std::mutex> g(lock);
+            ++queued;
+        }
+        wake.notify_one();
+    }
+    /* task to the queues in turn */
+    void submit (taskT task) {
+        size_t worker;
+        {
+            std::lock_guard<std::mutex> guard(lock);
+            worker = nextQueue++;
+        }
+        submit(worker, std::move(task));
+    }
+    
+    /* waiting for all submitted tasks */
+    void wait () {
+        std::unique_lock<std::mutex> guard(lock);
+        idle.wait(guard, [this] { return pending == 0; });
+    }
+};
+
+}
+
+#endif /* ThreadPool_hpp */